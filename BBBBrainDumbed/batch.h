@@ -0,0 +1,125 @@
+#pragma once
+#include<stdint.h>
+#include<vector>
+#include<deque>
+#include<memory>
+#include<mutex>
+#include<thread>
+#include<exception>
+#include<algorithm>
+
+#include"memory.h"
+
+using namespace std;
+
+template<class Machine> class BatchJob {
+public:
+	Machine machine;	//configuration going in, final registers and memory coming out
+	size_t budget = 0;	//ticks to execute
+
+	BatchJob(const Machine& machine, size_t budget) : machine(machine), budget(budget) {
+
+	}
+};
+
+/*
+runs independent machines over one shared ROM on a work-stealing thread pool.
+every machine gets the ROM through Memory::Load: the 32 KB of predecoded opcodes are stored once,
+the 4 KB of ROM bits are copied into each machine, as str may write them.
+each worker takes jobs from the back of its own deque and steals from the front of the others once it runs dry.
+*/
+template<class Machine> class Batch {
+public:
+	shared_ptr<const Rom> Image;
+	deque<BatchJob<Machine>> Jobs;	//a deque, as a machine has no move and growing never copies the jobs added
+
+	explicit Batch(shared_ptr<const Rom> image) : Image(image) {
+
+	}
+
+	void Add(const Machine& machine, size_t budget) {	//copies machine once, into a job built in place
+		Jobs.emplace_back(machine, budget);
+	}
+
+	void Run(size_t threads = 0) {	//0 uses every hardware thread. rethrows the first exception a job threw
+		if (threads == 0)
+		{
+			threads = max(1u, thread::hardware_concurrency());
+		}
+		threads = max((size_t)1, min(threads, Jobs.size()));
+		vector<Queue> queues(threads);
+		for (size_t i = 0; i < Jobs.size(); i++)	//contiguous runs, so neighbouring jobs share a worker until stolen
+		{
+			queues[i * threads / Jobs.size()].jobs.push_back(i);
+		}
+		failure = nullptr;
+		vector<thread> workers;
+		for (size_t i = 1; i < threads; i++)
+		{
+			workers.emplace_back([this, &queues, i]() { work(queues, i); });
+		}
+		work(queues, 0);
+		for (size_t i = 0; i < workers.size(); i++)
+		{
+			workers[i].join();
+		}
+		if (failure != nullptr)
+		{
+			rethrow_exception(failure);
+		}
+	}
+
+private:
+	class Queue {
+	public:
+		mutex lock;
+		deque<size_t> jobs;
+	};
+
+	mutex failureLock;
+	exception_ptr failure;
+
+	bool take(vector<Queue>& queues, size_t self, size_t& job) {
+		{
+			lock_guard<mutex> guard(queues[self].lock);
+			if (!queues[self].jobs.empty())
+			{
+				job = queues[self].jobs.back();
+				queues[self].jobs.pop_back();
+				return true;
+			}
+		}
+		for (size_t i = 1; i < queues.size(); i++)
+		{
+			Queue& victim = queues[(self + i) % queues.size()];
+			lock_guard<mutex> guard(victim.lock);
+			if (!victim.jobs.empty())
+			{
+				job = victim.jobs.front();
+				victim.jobs.pop_front();
+				return true;
+			}
+		}
+		return false;
+	}
+
+	void work(vector<Queue>& queues, size_t self) {
+		size_t job;
+		while (take(queues, self, job))
+		{
+			try
+			{
+				Jobs[job].machine.memory.Load(Image);
+				Jobs[job].machine.Execute(Jobs[job].budget);
+			}
+			catch (...)
+			{
+				lock_guard<mutex> guard(failureLock);
+				if (failure == nullptr)
+				{
+					failure = current_exception();
+				}
+			}
+		}
+	}
+};
@@ -0,0 +1,21 @@
+;ALU-heavy: 16-bit adds by ad4 and ad1, bit copies by bse and bxo, one lap per block
+cli
+ldi 0x1357
+mtx
+ldi 0x2468
+mty
+loop:
+cli clc
+ad4 ad4 ad4 ad4
+mtx
+cli clc
+ad1 ad1 ad1 ad1 ad1 ad1 ad1 ad1
+ad1 ad1 ad1 ad1 ad1 ad1 ad1 ad1
+mty
+cli
+bse bse bse bse bse bse bse bse
+bxo bxo bxo bxo bxo bxo bxo bxo
+mtd
+cli
+ldi loop
+mtp
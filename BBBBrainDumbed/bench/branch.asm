@@ -0,0 +1,34 @@
+;branch-heavy: a counter steering a bzz and a bcc every lap, short blocks throughout
+cli
+ldi 0
+mtx
+ldi 1
+mty
+loop:
+cli clc
+ad4 ad4 ad4 ad4
+mtx
+cli
+ld4 lde ld0 ld0 ;even addr
+mta
+mfn cli bse
+bzz
+mfx mtd
+cli
+ld0 ldf ld0 ld0 ;join addr
+mta
+mfn
+bzz
+even:
+mfx mte
+join:
+cli
+lde ld3 ld1 ld0 ;skip addr
+mta
+mfx cli bse mtc
+bcc
+mfd mtb
+skip:
+cli
+ldi loop
+mtp
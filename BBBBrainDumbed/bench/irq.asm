@@ -0,0 +1,27 @@
+;IRQ-heavy: a counting loop in B, interrupted by a handler counting IRQs in D
+cli
+ld2 lda ld0 ld0 ;handler addr
+mtv
+ldi 1
+mty
+clm
+loop:
+cli clc
+mfb mtx
+ad4 ad4 ad4 ad4
+mtb
+cli
+ldi loop
+mtp
+handler:
+sem
+mfv mte
+mfd mtx
+cli clc
+ad4 ad4 ad4 ad4
+mtd
+cli
+ldi handler
+mtv
+clm
+mfe mtp
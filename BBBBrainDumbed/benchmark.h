@@ -0,0 +1,207 @@
+#pragma once
+#include<stdint.h>
+#include<string>
+#include<vector>
+#include<map>
+#include<fstream>
+#include<sstream>
+#include<chrono>
+#include<functional>
+#include<algorithm>
+#include<memory>
+#include<cmath>
+
+#include"memory.h"
+#include"blockcache.h"
+#include"lockstep.h"
+
+using namespace std;
+
+/*
+throughput regression suite. every workload runs Repeat times from reset for Ticks ticks on a fresh machine after one untimed warm-up,
+the result is the median ticks and instructions per wall-clock second with the relative standard deviation of ticks per second.
+a baseline file holds one line per workload: name ticks_per_second instructions_per_second.
+a workload regresses when its median ticks per second falls more than Threshold percent below its baseline.
+baselines are only comparable on the machine and build that recorded them.
+with Lockstepped, every run executes Lanes identical copies of the workload together in a Lockstep and the rates count every lane,
+so against the same workload run alone they give the gain of lockstep over one core per machine. results are named workload-lockstep.
+*/
+template<class Machine> class Benchmark {
+public:
+	class Workload {
+	public:
+		string Name;
+		string File;	//assembly source, relative to the suite directory
+		function<void(Machine&)> Setup;	//registers, memory and events before the run
+		shared_ptr<const Rom> Program;	//filled in by the caller from File
+	};
+
+	class Result {
+	public:
+		string Name;
+		double TicksPerSecond = 0;	//median
+		double InstructionsPerSecond = 0;	//median
+		double Deviation = 0;	//relative standard deviation of ticks per second, percent
+		double Baseline = 0;	//ticks per second, 0 if the baseline has no entry
+		bool Regressed = false;
+
+		double Change() const {	//percent against the baseline
+			return Baseline > 0 ? (TicksPerSecond / Baseline - 1) * 100 : 0;
+		}
+	};
+
+	uint64_t Ticks = 20000000;	//per run
+	size_t Repeat = 7;
+	double Threshold = 5;	//percent
+	Engine engine = Engine::Blocks;
+	static const size_t Lanes = 32;
+	bool Lockstepped = false;
+
+	static vector<Workload> Suite() {	//the workloads shipped in bench/
+		vector<Workload> suite(4);
+		suite[0].Name = "copy";	//the LD16M/ST16A loop of main.asm, as wmain starts it
+		suite[0].File = "../main.asm";
+		suite[0].Setup = [](Machine& machine) {
+			machine.Z = 12345;
+			machine.X = 60000;
+			machine.Y = 10000;
+			machine.C = true;
+			machine.A = 0x8000;
+			machine.memory.write(0x8000, (uint16_t)52149);
+		};
+		suite[1].Name = "alu";
+		suite[1].File = "alu.asm";
+		suite[2].Name = "branch";
+		suite[2].File = "branch.asm";
+		suite[3].Name = "irq";
+		suite[3].File = "irq.asm";
+		suite[3].Setup = [](Machine& machine) {
+			pulse(machine, 1000, 40);
+		};
+		return suite;
+	}
+
+	vector<Result> Run(const vector<Workload>& workloads, const map<string, double>& baseline) const {
+		vector<Result> results;
+		for (size_t i = 0; i < workloads.size(); i++)
+		{
+			vector<double> ticks, instructions;
+			for (size_t j = 0; j <= Repeat; j++)
+			{
+				vector<Machine> machines(Lockstepped ? Lanes : 1);
+				for (size_t l = 0; l < machines.size(); l++)
+				{
+					machines[l].engine = engine;
+					machines[l].memory.Load(workloads[i].Program);
+					if (workloads[i].Setup)
+					{
+						workloads[i].Setup(machines[l]);
+					}
+				}
+				chrono::steady_clock::time_point start = chrono::steady_clock::now();
+				if (Lockstepped)
+				{
+					Lockstep<Machine, Lanes> lockstep;
+					for (size_t l = 0; l < Lanes; l++)
+					{
+						lockstep.Machines[l] = &machines[l];
+					}
+					lockstep.Execute((size_t)Ticks);
+				}
+				else
+				{
+					machines[0].Execute((size_t)Ticks);
+				}
+				double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+				uint64_t tick = 0, executed = 0;
+				for (size_t l = 0; l < machines.size(); l++)
+				{
+					tick += machines[l].Tick;
+					executed += machines[l].Instructions;
+				}
+				if (j != 0 && seconds > 0)	//the first run warms caches and translations
+				{
+					ticks.push_back(tick / seconds);
+					instructions.push_back(executed / seconds);
+				}
+			}
+			Result result;
+			result.Name = workloads[i].Name + (Lockstepped ? "-lockstep" : "");
+			result.TicksPerSecond = median(ticks);
+			result.InstructionsPerSecond = median(instructions);
+			result.Deviation = deviation(ticks);
+			typename map<string, double>::const_iterator found = baseline.find(result.Name);
+			if (found != baseline.end())
+			{
+				result.Baseline = found->second;
+				result.Regressed = result.TicksPerSecond < result.Baseline * (1 - Threshold / 100);
+			}
+			results.push_back(result);
+		}
+		return results;
+	}
+
+	static map<string, double> LoadBaseline(const string& file) {	//ticks per second by workload name, empty if file cannot be read
+		map<string, double> baseline;
+		ifstream ifs(file);
+		string line;
+		while (getline(ifs, line))
+		{
+			istringstream fields(line);
+			string name;
+			double ticks = 0;
+			if (fields >> name >> ticks)
+			{
+				baseline[name] = ticks;
+			}
+		}
+		return baseline;
+	}
+
+	static bool SaveBaseline(const string& file, const vector<Result>& results) {
+		ofstream ofs(file);
+		for (size_t i = 0; i < results.size(); i++)
+		{
+			ofs << results[i].Name << ' ' << results[i].TicksPerSecond << ' ' << results[i].InstructionsPerSecond << '\n';
+		}
+		return !ofs.fail();
+	}
+
+private:
+	static void pulse(Machine& machine, uint64_t period, uint64_t width) {	//raises IRQ for width ticks every period ticks
+		Machine* target = &machine;
+		machine.events.Post(machine.Tick + period, EventType::Callback, [target, period, width]() {
+			target->IRQ = true;
+			target->PostIRQ(target->Tick + width, false);
+			pulse(*target, period, width);
+		});
+	}
+
+	static double median(vector<double> samples) {
+		if (samples.empty())
+		{
+			return 0;
+		}
+		sort(samples.begin(), samples.end());
+		size_t half = samples.size() / 2;
+		return samples.size() % 2 != 0 ? samples[half] : (samples[half - 1] + samples[half]) / 2;
+	}
+
+	static double deviation(const vector<double>& samples) {
+		if (samples.size() < 2)
+		{
+			return 0;
+		}
+		double mean = 0, square = 0;
+		for (size_t i = 0; i < samples.size(); i++)
+		{
+			mean += samples[i];
+		}
+		mean /= samples.size();
+		for (size_t i = 0; i < samples.size(); i++)
+		{
+			square += (samples[i] - mean) * (samples[i] - mean);
+		}
+		return mean > 0 ? sqrt(square / (samples.size() - 1)) / mean * 100 : 0;
+	}
+};
@@ -0,0 +1,206 @@
+#pragma once
+#include<stdint.h>
+#include<vector>
+
+using namespace std;
+
+enum class Engine {
+	Interpreter,	//threaded interpreter
+	Blocks,	//translated basic blocks, falling back to the interpreter
+	Jit,	//hot blocks compiled to native code where supported, otherwise Blocks
+};
+
+class MicroOp {
+public:
+	static const uint8_t FusedLoad = 64;	//ld* x4, operand holds the nibbles in load order
+	static const uint8_t FusedAdd = 65;	//ad4 x4
+
+	uint8_t opcode = 0;	//instruction opcode or one of the fused opcodes above
+	uint16_t operand = 0;
+	uint16_t next = 0;	//P after fetching this instruction
+	uint16_t count = 0;	//instructions from block entry to the end of this one
+	uint32_t ticks = 0;	//ticks from block entry to the end of this instruction
+
+	uint8_t lastOpcode() const {	//opcode of the last instruction covered, as left in inst
+		if (opcode == FusedLoad)
+		{
+			return 32 + (operand >> 12);
+		}
+		if (opcode == FusedAdd)
+		{
+			return 27;
+		}
+		return opcode;
+	}
+};
+
+enum class Idiom {	//whole loops RunBlocks can run as one word-level transfer
+	Unchecked,
+	None,
+	LoadBits,	//LD16M: B[J..15] = (A)..., A += 1 by ad4 x4
+	StoreBits,	//ST16A: (A)... = B[J..15], A += 1 by a single ad4
+};
+
+class Block {	//straight-line guest code, entered at stage 1
+public:
+	uint16_t start = 0;
+	uint32_t ticks = 0;	//total tick cost
+	vector<MicroOp> ops;
+	vector<uint8_t> opcodes;	//as fetched, one per instruction, for traces
+	const void* tracer = nullptr;	//TraceBuffer holding a copy of opcodes
+	uint32_t traced = 0;	//where, in its code ring
+	uint32_t uses = 0;	//times replayed, for picking blocks worth compiling
+	void* code = nullptr;	//native entry point once compiled
+	bool pure = true;	//no str, so a rerun from unchanged registers changes nothing
+	Idiom idiom = Idiom::Unchecked;	//loop shape headed by this block
+	uint32_t tailTicks = 0;	//ticks of the block jumping back here, for idioms
+	uint16_t tailCount = 0;	//instructions of that block
+	uint16_t exit = 0;	//P once an idiom loop finishes
+
+	/*
+	matches the bit-serial copy loops of main.asm, with tail being the block after the bzz:
+		head: mfb ldr mtb mfa mtx sec ad4 ad4 ad4 ad4 mtx ld* x4(exit) mta mfj bzz
+		  or: mfb str mfa mtx sec ad4 mtx cli ld* x4(exit) mta mfj bzz
+		tail: mfx mta ld* x4(head) mtp
+	*/
+	void matchLoop(const Block& tail) {
+		static const uint8_t load[] = { 12, 28, 4, 11, 1, 49, MicroOp::FusedAdd, 1, MicroOp::FusedLoad, 3, 31, 54 };
+		static const uint8_t store[] = { 12, 29, 11, 1, 49, 27, 1, 52, MicroOp::FusedLoad, 3, 31, 54 };
+		static const uint8_t back[] = { 9, 3, MicroOp::FusedLoad, 7 };
+		idiom = Idiom::None;
+		if (!is(tail, back, 4) || tail.start != ops.back().next || tail.ops[2].operand != start)
+		{
+			return;
+		}
+		if (is(*this, load, 12))
+		{
+			idiom = Idiom::LoadBits;
+		}
+		else if (is(*this, store, 12))
+		{
+			idiom = Idiom::StoreBits;
+		}
+		else
+		{
+			return;
+		}
+		tailTicks = tail.ticks;
+		tailCount = tail.ops.back().count;
+		exit = ops[8].operand;
+	}
+
+	void fuse() {	//collapse trailing ld* x4 or ad4 x4 into one micro-op
+		size_t n = ops.size();
+		if (n < 4)
+		{
+			return;
+		}
+		bool load = true, add = true;
+		for (size_t i = n - 4; i < n; i++)
+		{
+			load = load && ops[i].opcode >= 32 && ops[i].opcode <= 47;
+			add = add && ops[i].opcode == 27;
+		}
+		if (!load && !add)
+		{
+			return;
+		}
+		MicroOp op = ops[n - 1];
+		op.opcode = load ? MicroOp::FusedLoad : MicroOp::FusedAdd;
+		op.operand = 0;
+		for (size_t i = 0; load && i < 4; i++)
+		{
+			op.operand |= (uint16_t)((ops[n - 4 + i].opcode - 32) << (i * 4));
+		}
+		ops.resize(n - 4);
+		ops.push_back(op);
+	}
+
+	uint16_t countAt(uint32_t spent) const {	//instructions run by a partial pass that took spent ticks
+		size_t low = 0, high = ops.size();
+		while (low < high)
+		{
+			size_t middle = (low + high) / 2;
+			if (ops[middle].ticks < spent)
+			{
+				low = middle + 1;
+			}
+			else
+			{
+				high = middle;
+			}
+		}
+		return low < ops.size() ? ops[low].count : ops.back().count;
+	}
+
+	static bool endsBlock(uint8_t opcode) {	//writes P or may clear M
+		return opcode == 7 || opcode == 50 || opcode == 54 || opcode == 55 || opcode == 62;	//mtp, clm, bzz, bcc, mtm
+	}
+
+private:
+	static bool is(const Block& block, const uint8_t* opcodes, size_t count) {
+		if (block.ops.size() != count)
+		{
+			return false;
+		}
+		for (size_t i = 0; i < count; i++)
+		{
+			if (block.ops[i].opcode != opcodes[i])
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+};
+
+class BlockCache {
+public:
+	static const size_t MaxLength = 64;	//instructions per block
+
+	vector<Block> blocks;
+	vector<vector<int32_t>> index;	//[address >> 8][address & 0xff] -> position in blocks, -1 if not translated
+	uint32_t version = 0;	//Memory::CodeVersion the blocks were translated against
+
+	BlockCache() : index(0x100) {
+
+	}
+
+	BlockCache(const BlockCache&) : index(0x100) {	//translations belong to one machine
+
+	}
+
+	BlockCache& operator=(const BlockCache&) {
+		clear();
+		version = 0;
+		return *this;
+	}
+
+	Block* find(uint16_t address) {
+		const vector<int32_t>& page = index[address >> 8];
+		if (page.empty() || page[address & 0xff] < 0)
+		{
+			return nullptr;
+		}
+		return &blocks[page[address & 0xff]];
+	}
+
+	Block* insert(const Block& block) {
+		vector<int32_t>& page = index[block.start >> 8];
+		if (page.empty())
+		{
+			page.assign(0x100, -1);
+		}
+		page[block.start & 0xff] = (int32_t)blocks.size();
+		blocks.push_back(block);
+		return &blocks.back();
+	}
+
+	void clear() {
+		blocks.clear();
+		for (size_t i = 0; i < index.size(); i++)
+		{
+			index[i].clear();
+		}
+	}
+};
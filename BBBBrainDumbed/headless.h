@@ -0,0 +1,790 @@
+#pragma once
+#include<stdint.h>
+#include<string>
+#include<vector>
+#include<list>
+#include<map>
+#include<fstream>
+#include<iostream>
+#include<iterator>
+#include<chrono>
+#include<stdexcept>
+#include<memory>
+#include<thread>
+#include<tuple>
+#include<algorithm>
+#include<cmath>
+
+#include"memory.h"
+#include"blockcache.h"
+#include"benchmark.h"
+#include"verifier.h"
+#include"profiler.h"
+#include"trace.h"
+#include"movie.h"
+
+using namespace std;
+
+/*
+command line runner using nothing but the standard library, the entry point where there is no wmain:
+	BBBBrainDumbed [options] file
+	file                assembly source, or a ROM image with --rom
+	--rom               file is a raw ROM image, address n is bit n % 8 of byte n / 8
+	--ticks N           tick budget, default 1516881
+	--instructions N    instruction budget instead, stops right after the N-th instruction completes
+	--set R=V           initial value of Z X Y A B D E P V T I J C M IRQ or stage, repeatable
+	--poke A=V          16-bit V written at bit address A before running, repeatable
+	--peek A            16-bit word at bit address A reported after running, repeatable
+	--engine E          interpreter, blocks or jit
+	--profile FILE      runs stage by stage under Profiler and writes its hot lines and, for a source, the annotated listing to FILE
+	--trace FILE        records instructions in a TraceBuffer and dumps it to FILE when the run ends, see trace.h
+	--trace-size N      records kept, at least 64, default 1048576
+	--trigger A         dumps the trace as soon as address A is executed instead
+	--break A           stops before the instruction at A, repeatable
+	--watch A           stops after a str writes the bit at A, repeatable
+	--changes           tracks VRAM and ARAM and reports every bit they change
+	--input0 T=B        sets ControllerInput0 to the 5 bits B at tick T during the run, repeatable. --input1 for ControllerInput1
+	--record FILE       writes the run's inputs to the movie FILE, see movie.h
+	BBBBrainDumbed --decode file
+	                    prints the trace dump file as text
+	BBBBrainDumbed --replay FILE [--rom] [--engine E] file
+	                    replays the movie FILE on the program file as fast as possible and checks the state it ends on
+	BBBBrainDumbed --bench [--ticks N] [--repeat N] [--baseline FILE [--threshold PCT | --save-baseline]] [--engine E] [--lockstep] directory
+	directory           holds the workloads of Benchmark::Suite, bench/ in the source tree
+	--ticks N           ticks per run, default 20000000
+	--repeat N          timed runs per workload, default 7
+	--baseline FILE     compares against FILE, see benchmark.h
+	--threshold PCT     allowed drop below the baseline, default 5
+	--save-baseline     writes the results to FILE instead of comparing
+	--lockstep          runs 32 copies of every workload together through Lockstep, see benchmark.h
+	BBBBrainDumbed --verify [--ticks N] [--interval N] [--engine E] [--seeds N] [--seed S] [--threads N] [--lockstep | file options] [file]
+	                    checks engine E against the stepped interpreter, see verifier.h: on file, or on random programs without one
+	--interval N        ticks between comparisons, default 100000
+	--seeds N           random programs to check, default 100
+	--seed S            first seed, default 1
+	--threads N         default every hardware thread
+	--lockstep          checks Lockstep instead, 32 machines per random program against their own Execute with engine E, see verifier.h
+numbers take C prefixes, 0x for hex.
+prints one JSON object on success: budget, ticks, instructions, seconds, ticks_per_second, instructions_per_second, stop, stop_address, registers, peek, changes with --changes as [tick, address, value],
+or for --bench: ticks, repeat, threshold, workloads with name, ticks_per_second, instructions_per_second, deviation, baseline, change and regressed, then regressed,
+or for --verify: ticks, verified, then divergence, null or its seed, lane with --lockstep, tick, P, opcode, registers and words,
+or for --replay: ticks, inputs, seconds, ticks_per_second, hash, expected and matched.
+--decode prints one line per instruction instead.
+returns 1 for bad arguments, 2 if a file cannot be read or written, 3 if a source does not assemble, 4 if a workload regressed, 5 if the engines diverged,
+6 if a replay ended on another state or the movie was recorded with another ROM.
+*/
+template<class Machine> class Headless {
+public:
+	static int Run(int argc, char* argv[], wostream& out) {
+		try
+		{
+			Headless runner;
+			runner.parse(argc, argv);
+			return runner.run(out);
+		}
+		catch (const invalid_argument& e)
+		{
+			wcerr << widen(e.what()) << endl;
+			return 1;
+		}
+	}
+
+private:
+	string file;
+	bool image = false;
+	bool counted = false;	//budget counts instructions
+	uint64_t budget = 1516881;
+	bool budgeted = false;	//--ticks or --instructions given
+	vector<pair<string, uint64_t>> sets;
+	vector<pair<uint16_t, uint16_t>> pokes;
+	vector<uint16_t> peeks;
+	Engine engine = Engine::Blocks;
+	bool bench = false;
+	size_t repeat = 7;
+	string baseline;
+	double threshold = 5;
+	bool save = false;
+	bool verify = false;
+	bool lockstep = false;
+	string profile;
+	string trace;
+	size_t traceSize = 1 << 20;
+	int32_t trigger = -1;
+	bool decode = false;
+	vector<uint16_t> breakpoints;
+	vector<uint16_t> watchpoints;
+	bool changes = false;
+	vector<tuple<uint64_t, uint8_t, uint8_t>> inputs;	//tick, port, bits
+	string record;
+	string replay;
+	wstring source;	//text of the last source loaded
+	uint64_t interval = 100000;
+	uint64_t seeds = 100;
+	uint64_t seed = 1;
+	unsigned threads = max(thread::hardware_concurrency(), 1u);
+
+	static wstring widen(const string& input) {	//byte for byte, so a path survives the round trip through Token::filename
+		return wstring(input.begin(), input.end());
+	}
+
+	static const wchar_t* flag(bool value) {
+		return value ? L"true" : L"false";
+	}
+
+	static uint64_t number(const string& input) {
+		size_t used = 0;
+		uint64_t value = 0;
+		try
+		{
+			value = stoull(input, &used, 0);
+		}
+		catch (const logic_error&)
+		{
+			used = 0;
+		}
+		if (used == 0 || used != input.size())
+		{
+			throw invalid_argument("Not a number: " + input);
+		}
+		return value;
+	}
+
+	static double decimal(const string& input) {	//non-negative and finite
+		size_t used = 0;
+		double value = 0;
+		try
+		{
+			value = stod(input, &used);
+		}
+		catch (const logic_error&)
+		{
+			used = 0;
+		}
+		if (used == 0 || used != input.size() || !isfinite(value) || value < 0)
+		{
+			throw invalid_argument("Not a number: " + input);
+		}
+		return value;
+	}
+
+	static pair<string, string> split(const string& input) {
+		size_t at = input.find('=');
+		if (at == string::npos)
+		{
+			throw invalid_argument("Expected name=value: " + input);
+		}
+		return make_pair(input.substr(0, at), input.substr(at + 1));
+	}
+
+	void parse(int argc, char* argv[]) {
+		for (int i = 1; i < argc; i++)
+		{
+			string option = argv[i];
+			bool valued = option == "--ticks" || option == "--instructions" || option == "--set" || option == "--poke" || option == "--peek" || option == "--engine" || option == "--repeat" || option == "--baseline" || option == "--threshold" || option == "--interval" || option == "--seeds" || option == "--seed" || option == "--threads" || option == "--profile" || option == "--trace" || option == "--trace-size" || option == "--trigger" || option == "--break" || option == "--watch" || option == "--input0" || option == "--input1" || option == "--record" || option == "--replay";
+			if (valued && i + 1 >= argc)
+			{
+				throw invalid_argument("Missing value for " + option);
+			}
+			if (option == "--rom")
+			{
+				image = true;
+			}
+			else if (option == "--ticks" || option == "--instructions")
+			{
+				counted = option == "--instructions";
+				budgeted = true;
+				budget = number(argv[++i]);
+			}
+			else if (option == "--bench")
+			{
+				bench = true;
+			}
+			else if (option == "--lockstep")
+			{
+				lockstep = true;
+			}
+			else if (option == "--repeat")
+			{
+				repeat = (size_t)number(argv[++i]);
+			}
+			else if (option == "--baseline")
+			{
+				baseline = argv[++i];
+			}
+			else if (option == "--threshold")
+			{
+				threshold = decimal(argv[++i]);
+			}
+			else if (option == "--save-baseline")
+			{
+				save = true;
+			}
+			else if (option == "--profile")
+			{
+				profile = argv[++i];
+			}
+			else if (option == "--trace")
+			{
+				trace = argv[++i];
+			}
+			else if (option == "--trace-size")
+			{
+				traceSize = (size_t)number(argv[++i]);
+			}
+			else if (option == "--trigger")
+			{
+				trigger = (int32_t)(uint16_t)number(argv[++i]);
+			}
+			else if (option == "--break")
+			{
+				breakpoints.push_back((uint16_t)number(argv[++i]));
+			}
+			else if (option == "--watch")
+			{
+				watchpoints.push_back((uint16_t)number(argv[++i]));
+			}
+			else if (option == "--input0" || option == "--input1")
+			{
+				pair<string, string> input = split(argv[++i]);
+				inputs.push_back(make_tuple(number(input.first), (uint8_t)(option == "--input1"), (uint8_t)number(input.second)));
+			}
+			else if (option == "--record")
+			{
+				record = argv[++i];
+			}
+			else if (option == "--replay")
+			{
+				replay = argv[++i];
+			}
+			else if (option == "--changes")
+			{
+				changes = true;
+			}
+			else if (option == "--decode")
+			{
+				decode = true;
+			}
+			else if (option == "--verify")
+			{
+				verify = true;
+			}
+			else if (option == "--interval")
+			{
+				interval = number(argv[++i]);
+			}
+			else if (option == "--seeds")
+			{
+				seeds = number(argv[++i]);
+			}
+			else if (option == "--seed")
+			{
+				seed = number(argv[++i]);
+			}
+			else if (option == "--threads")
+			{
+				threads = (unsigned)number(argv[++i]);
+			}
+			else if (option == "--set")
+			{
+				pair<string, string> set = split(argv[++i]);
+				sets.push_back(make_pair(set.first, number(set.second)));
+			}
+			else if (option == "--poke")
+			{
+				pair<string, string> poke = split(argv[++i]);
+				pokes.push_back(make_pair((uint16_t)number(poke.first), (uint16_t)number(poke.second)));
+			}
+			else if (option == "--peek")
+			{
+				peeks.push_back((uint16_t)number(argv[++i]));
+			}
+			else if (option == "--engine")
+			{
+				string name = argv[++i];
+				if (name == "interpreter")
+				{
+					engine = Engine::Interpreter;
+				}
+				else if (name == "blocks")
+				{
+					engine = Engine::Blocks;
+				}
+				else if (name == "jit")
+				{
+					engine = Engine::Jit;
+				}
+				else
+				{
+					throw invalid_argument("Unknown engine: " + name);
+				}
+			}
+			else if (option.size() > 2 && option.compare(0, 2, "--") == 0)
+			{
+				throw invalid_argument("Unknown option: " + option);
+			}
+			else if (file.empty())
+			{
+				file = option;
+			}
+			else
+			{
+				throw invalid_argument("More than one file given.");
+			}
+		}
+		if (file.empty() && !verify)
+		{
+			throw invalid_argument("Usage: BBBBrainDumbed [--rom] [--ticks N | --instructions N] [--set R=V]... [--poke A=V]... [--peek A]... [--break A]... [--watch A]... [--changes] [--input0 T=B]... [--input1 T=B]... [--record FILE] [--engine interpreter|blocks|jit] file\n"
+				"   or: BBBBrainDumbed --bench [--ticks N] [--repeat N] [--baseline FILE [--threshold PCT | --save-baseline]] [--engine interpreter|blocks|jit] [--lockstep] directory\n"
+				"   or: BBBBrainDumbed --decode file\n"
+				"   or: BBBBrainDumbed --replay FILE [--rom] [--engine interpreter|blocks|jit] file\n"
+				"   or: BBBBrainDumbed --verify [--ticks N] [--interval N] [--engine interpreter|blocks|jit] [--seeds N] [--seed S] [--threads N] [--lockstep | [--rom] [--set R=V]... [--poke A=V]... [file]]");
+		}
+		if (bench && (counted || image || !sets.empty() || !pokes.empty() || !peeks.empty()))
+		{
+			throw invalid_argument("--bench takes ticks only, and no --rom, --set, --poke or --peek.");
+		}
+		if ((bench || verify || decode) && (!profile.empty() || !trace.empty()))
+		{
+			throw invalid_argument("--profile and --trace cannot be combined with --bench, --verify or --decode.");
+		}
+		if (!profile.empty() && !trace.empty())
+		{
+			throw invalid_argument("--profile and --trace cannot be combined.");
+		}
+		if ((bench || verify || decode || !profile.empty()) && (!breakpoints.empty() || !watchpoints.empty()))
+		{
+			throw invalid_argument("--break and --watch cannot be combined with --bench, --verify, --decode or --profile.");
+		}
+		if ((bench || verify || decode) && (changes || !inputs.empty()))
+		{
+			throw invalid_argument("--changes and --input cannot be combined with --bench, --verify or --decode.");
+		}
+		if (trigger >= 0 && trace.empty())
+		{
+			throw invalid_argument("--trigger needs --trace.");
+		}
+		if (!replay.empty() && (bench || verify || decode || budgeted || !sets.empty() || !pokes.empty() || !peeks.empty() || !profile.empty() || !trace.empty()
+			|| !breakpoints.empty() || !watchpoints.empty() || changes || !inputs.empty() || !record.empty()))
+		{
+			throw invalid_argument("--replay takes a file, --rom and --engine only.");
+		}
+		if (!record.empty() && (bench || verify || decode || !profile.empty()))
+		{
+			throw invalid_argument("--record cannot be combined with --bench, --verify, --decode or --profile.");
+		}
+		if (decode && (bench || verify))
+		{
+			throw invalid_argument("--decode takes a file only.");
+		}
+		if (bench && verify)
+		{
+			throw invalid_argument("--bench and --verify cannot be combined.");
+		}
+		if (verify && (counted || !peeks.empty() || (file.empty() && (image || !sets.empty() || !pokes.empty()))))
+		{
+			throw invalid_argument("--verify takes ticks only, no --peek, and --rom, --set or --poke only with a file.");
+		}
+		if (lockstep && !bench && !(verify && file.empty()))
+		{
+			throw invalid_argument("--lockstep needs --bench, or --verify without a file.");
+		}
+		if (bench && repeat == 0)
+		{
+			throw invalid_argument("--repeat must be at least 1.");
+		}
+		if (traceSize < TraceBuffer::MinimumCapacity)
+		{
+			throw invalid_argument("--trace-size must be at least " + to_string(TraceBuffer::MinimumCapacity) + ".");
+		}
+		if (save && baseline.empty())
+		{
+			throw invalid_argument("--save-baseline needs --baseline.");
+		}
+	}
+
+	void set(Machine& machine, const string& name, uint64_t value) {
+		uint16_t* words[] = { &machine.Z, &machine.X, &machine.Y, &machine.A, &machine.B, &machine.D, &machine.E, &machine.P, &machine.V, &machine.T };
+		const char* names[] = { "Z", "X", "Y", "A", "B", "D", "E", "P", "V", "T" };
+		for (size_t i = 0; i < 10; i++)
+		{
+			if (name == names[i])
+			{
+				*words[i] = (uint16_t)value;
+				return;
+			}
+		}
+		if (name == "I" || name == "J")
+		{
+			(name == "I" ? machine.I : machine.J) = (uint8_t)(value & 0xf);
+		}
+		else if (name == "C" || name == "M" || name == "IRQ")
+		{
+			(name == "C" ? machine.C : name == "M" ? machine.M : machine.IRQ) = value != 0;
+		}
+		else if (name == "stage")
+		{
+			machine.stage = (uint8_t)value;
+		}
+		else
+		{
+			throw invalid_argument("Unknown register: " + name);
+		}
+	}
+
+	int load(const string& path, bool raw, vector<bool>& rom, typename Machine::DebugMap* debug = nullptr) {	//0 or the return code
+		ifstream ifs(path, ios_base::binary | ios_base::in);
+		if (ifs.fail())
+		{
+			wcerr << L"Cannot read " << widen(path) << endl;
+			return 2;
+		}
+		string input((istreambuf_iterator<char>(ifs)), istreambuf_iterator<char>());
+		ifs.close();
+		rom.clear();
+		if (raw)
+		{
+			for (size_t i = 0; i < input.size() * 8; i++)
+			{
+				rom.push_back(((uint8_t)input[i / 8] >> (i % 8)) & 1);
+			}
+		}
+		else
+		{
+			source = widen(input);
+			auto tokens = Machine::Tokenizer(source, widen(path));
+			if (Machine::CheckTokenError(*tokens) != 0)
+			{
+				return 3;
+			}
+			try
+			{
+				rom = Machine::Parser(tokens, debug);
+			}
+			catch (const runtime_error& e)
+			{
+				wcerr << L"Parser error\n" << widen(e.what()) << endl;
+				return 3;
+			}
+		}
+		return 0;
+	}
+
+	int benchmark(wostream& out) {
+		Benchmark<Machine> suite;
+		suite.engine = engine;
+		suite.Repeat = repeat;
+		suite.Threshold = threshold;
+		suite.Lockstepped = lockstep;
+		if (budgeted)
+		{
+			suite.Ticks = budget;
+		}
+		vector<typename Benchmark<Machine>::Workload> workloads = Benchmark<Machine>::Suite();
+		for (size_t i = 0; i < workloads.size(); i++)
+		{
+			vector<bool> rom;
+			int code = load(file + "/" + workloads[i].File, false, rom);
+			if (code != 0)
+			{
+				return code;
+			}
+			workloads[i].Program = make_shared<const Rom>(rom);
+		}
+		map<string, double> reference;
+		if (!baseline.empty() && !save)
+		{
+			reference = Benchmark<Machine>::LoadBaseline(baseline);
+			if (reference.empty())
+			{
+				wcerr << L"Cannot read " << widen(baseline) << endl;
+				return 2;
+			}
+		}
+		vector<typename Benchmark<Machine>::Result> results = suite.Run(workloads, reference);
+		if (save && !Benchmark<Machine>::SaveBaseline(baseline, results))
+		{
+			wcerr << L"Cannot write " << widen(baseline) << endl;
+			return 2;
+		}
+		bool regressed = false;
+		out << L"{\"ticks\":" << suite.Ticks << L",\"repeat\":" << suite.Repeat << L",\"threshold\":" << suite.Threshold << L",\"workloads\":[";
+		for (size_t i = 0; i < results.size(); i++)
+		{
+			out << (i == 0 ? L"" : L",") << L"{\"name\":\"" << widen(results[i].Name) << L"\"";
+			out << L",\"ticks_per_second\":" << results[i].TicksPerSecond << L",\"instructions_per_second\":" << results[i].InstructionsPerSecond;
+			out << L",\"deviation\":" << results[i].Deviation << L",\"baseline\":" << results[i].Baseline << L",\"change\":" << results[i].Change();
+			out << L",\"regressed\":" << flag(results[i].Regressed) << L"}";
+			regressed = regressed || results[i].Regressed;
+		}
+		out << L"],\"regressed\":" << flag(regressed) << L"}" << endl;
+		return regressed ? 4 : 0;
+	}
+
+	void prepare(Machine& machine, shared_ptr<const Rom> rom) {	//loads rom, then applies --set and --poke
+		machine.memory.Load(rom);
+		for (size_t i = 0; i < sets.size(); i++)
+		{
+			set(machine, sets[i].first, sets[i].second);
+		}
+		for (size_t i = 0; i < pokes.size(); i++)
+		{
+			machine.memory.write(pokes[i].first, pokes[i].second);
+		}
+	}
+
+	int verification(wostream& out) {
+		Verifier<Machine> verifier;
+		verifier.Candidate = engine;
+		verifier.Interval = interval;
+		verifier.Lockstepped = lockstep;
+		uint64_t ticks = budgeted ? budget : 1000000;
+		Divergence divergence;
+		uint64_t verified = 0;
+		bool agreed;
+		if (file.empty())
+		{
+			agreed = verifier.Soak(seed, seeds, ticks, threads, divergence, verified);
+		}
+		else
+		{
+			vector<bool> rom;
+			int code = load(file, image, rom);
+			if (code != 0)
+			{
+				return code;
+			}
+			Machine reference, candidate;
+			shared_ptr<const Rom> program = make_shared<const Rom>(rom);
+			prepare(reference, program);
+			prepare(candidate, program);
+			agreed = verifier.Verify(reference, candidate, ticks, divergence);
+			verified = agreed ? 1 : 0;
+		}
+		out << L"{\"ticks\":" << ticks << L",\"verified\":" << verified << L",\"divergence\":";
+		if (agreed)
+		{
+			out << L"null}" << endl;
+			return 0;
+		}
+		out << L"{\"seed\":" << divergence.Seed << (lockstep ? L",\"lane\":" + to_wstring(divergence.Lane) : L"") << L",\"tick\":" << divergence.Tick << L",\"P\":" << divergence.P << L",\"opcode\":" << (unsigned)divergence.Opcode << L",\"registers\":[";
+		for (size_t i = 0; i < divergence.Registers.size(); i++)
+		{
+			out << (i == 0 ? L"" : L",") << L"\"" << widen(divergence.Registers[i]) << L"\"";
+		}
+		out << L"],\"words\":[";
+		for (size_t i = 0; i < divergence.Words.size(); i++)
+		{
+			out << (i == 0 ? L"" : L",") << L"[" << divergence.Words[i].first * 64 << L"," << divergence.Words[i].second.first << L"," << divergence.Words[i].second.second << L"]";
+		}
+		out << L"]}}" << endl;
+		return 5;
+	}
+
+	int decoding(wostream& out) {
+		ifstream ifs(file, ios_base::binary | ios_base::in);
+		if (ifs.fail())
+		{
+			wcerr << L"Cannot read " << widen(file) << endl;
+			return 2;
+		}
+		vector<uint8_t> data((istreambuf_iterator<char>(ifs)), istreambuf_iterator<char>());
+		try
+		{
+			TraceBuffer::Decode(TraceBuffer::Load(data), out);
+		}
+		catch (const logic_error& e)
+		{
+			wcerr << widen(e.what()) << endl;
+			return 2;
+		}
+		return 0;
+	}
+
+	int replaying(wostream& out) {
+		ifstream ifs(replay, ios_base::binary | ios_base::in);
+		if (ifs.fail())
+		{
+			wcerr << L"Cannot read " << widen(replay) << endl;
+			return 2;
+		}
+		vector<uint8_t> data((istreambuf_iterator<char>(ifs)), istreambuf_iterator<char>());
+		Movie movie;
+		try
+		{
+			movie = Movie::Load(data);
+		}
+		catch (const logic_error& e)
+		{
+			wcerr << widen(e.what()) << endl;
+			return 2;
+		}
+		vector<bool> rom;
+		int code = load(file, image, rom);
+		if (code != 0)
+		{
+			return code;
+		}
+		Machine machine;
+		machine.engine = engine;
+		uint64_t hash = 0;
+		bool matched;
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		try
+		{
+			matched = movie.Replay(machine, make_shared<const Rom>(rom), hash);
+		}
+		catch (const logic_error& e)
+		{
+			wcerr << widen(e.what()) << endl;
+			return 6;
+		}
+		double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+		out << L"{\"ticks\":" << machine.Tick << L",\"inputs\":" << movie.Inputs.size() << L",\"seconds\":" << seconds;
+		out << L",\"ticks_per_second\":" << (seconds > 0 ? machine.Tick / seconds : 0);
+		out << L",\"hash\":" << hash << L",\"expected\":" << movie.FinalHash << L",\"matched\":" << flag(matched) << L"}" << endl;
+		return matched ? 0 : 6;
+	}
+
+	int run(wostream& out) {
+		if (bench)
+		{
+			return benchmark(out);
+		}
+		if (!replay.empty())
+		{
+			return replaying(out);
+		}
+		if (verify)
+		{
+			return verification(out);
+		}
+		if (decode)
+		{
+			return decoding(out);
+		}
+		vector<bool> rom;
+		typename Machine::DebugMap debug;
+		int code = load(file, image, rom, &debug);
+		if (code != 0)
+		{
+			return code;
+		}
+		Machine machine;
+		machine.engine = engine;
+		prepare(machine, make_shared<const Rom>(rom));
+		unique_ptr<Profiler<Machine>> profiler(profile.empty() ? nullptr : new Profiler<Machine>());
+		unique_ptr<TraceBuffer> recorder(trace.empty() ? nullptr : new TraceBuffer(traceSize));
+		if (recorder)
+		{
+			recorder->File = trace;
+			recorder->Trigger = trigger;
+			machine.Recorder = recorder.get();
+		}
+		for (size_t i = 0; i < breakpoints.size(); i++)
+		{
+			machine.memory.SetBreakpoint(breakpoints[i]);
+		}
+		for (size_t i = 0; i < watchpoints.size(); i++)
+		{
+			machine.memory.SetWatchpoint(watchpoints[i]);
+		}
+		if (changes)
+		{
+			machine.memory.Track(0xc000, 0xefff);
+		}
+		for (size_t i = 0; i < inputs.size(); i++)
+		{
+			machine.PostInput(get<0>(inputs[i]), get<1>(inputs[i]), get<2>(inputs[i]));
+		}
+		Movie movie;
+		if (!record.empty())
+		{
+			movie.Begin(machine);
+		}
+		auto execute = [&](size_t count) {
+			if (profiler)
+			{
+				profiler->Execute(machine, count);
+				return StopReason::None;
+			}
+			return machine.Execute(count);
+		};
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		if (counted)	//every instruction takes at least 8 ticks, so no slice completes more than were asked for. the last one goes stage by stage
+		{
+			while (machine.Instructions < budget)
+			{
+				uint64_t left = budget - machine.Instructions;
+				if (execute(left > 1 ? (size_t)(left - 1) * 8 : 1) != StopReason::None)
+				{
+					break;
+				}
+			}
+		}
+		else
+		{
+			execute((size_t)budget);
+		}
+		double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+		if (!record.empty())
+		{
+			movie.Finish(machine);
+			vector<uint8_t> data = movie.Save();
+			ofstream ofs(record, ios_base::binary | ios_base::out);
+			ofs.write((const char*)data.data(), data.size());
+			if (ofs.fail())
+			{
+				wcerr << L"Cannot write " << widen(record) << endl;
+				return 2;
+			}
+		}
+		if (recorder && !recorder->Triggered && !recorder->Dump(trace))
+		{
+			wcerr << L"Cannot write " << widen(trace) << endl;
+			return 2;
+		}
+		if (profiler)
+		{
+			wofstream report(profile);
+			profiler->HotLines(debug, report);
+			if (!image)
+			{
+				report << endl;
+				profiler->Listing(debug, widen(file), source, report);
+			}
+			if (report.fail())
+			{
+				wcerr << L"Cannot write " << widen(profile) << endl;
+				return 2;
+			}
+		}
+		out << L"{\"budget\":" << budget << L",\"unit\":\"" << (counted ? L"instructions" : L"ticks") << L"\"";
+		out << L",\"ticks\":" << machine.Tick << L",\"instructions\":" << machine.Instructions << L",\"seconds\":" << seconds;
+		out << L",\"ticks_per_second\":" << (seconds > 0 ? machine.Tick / seconds : 0);
+		out << L",\"instructions_per_second\":" << (seconds > 0 ? machine.Instructions / seconds : 0);
+		out << L",\"stop\":\"" << (machine.Stopped == StopReason::Breakpoint ? L"breakpoint" : machine.Stopped == StopReason::Watchpoint ? L"watchpoint" : L"none") << L"\"";
+		out << L",\"stop_address\":" << machine.StopAddress;
+		out << L",\"registers\":{\"Z\":" << machine.Z << L",\"X\":" << machine.X << L",\"Y\":" << machine.Y << L",\"A\":" << machine.A << L",\"B\":" << machine.B;
+		out << L",\"D\":" << machine.D << L",\"E\":" << machine.E << L",\"P\":" << machine.P << L",\"V\":" << machine.V << L",\"T\":" << machine.T;
+		out << L",\"I\":" << (unsigned)machine.I << L",\"J\":" << (unsigned)machine.J << L",\"C\":" << flag(machine.C) << L",\"M\":" << flag(machine.M) << L",\"IRQ\":" << flag(machine.IRQ);
+		out << L",\"inst\":" << (unsigned)machine.inst << L",\"stage\":" << (unsigned)machine.stage << L"}";
+		out << L",\"peek\":{";
+		for (size_t i = 0; i < peeks.size(); i++)
+		{
+			out << (i == 0 ? L"" : L",") << L"\"" << peeks[i] << L"\":" << machine.memory.read16(peeks[i]);
+		}
+		out << L"}";
+		if (changes)
+		{
+			vector<MemoryChange> changed = machine.memory.Drain();
+			out << L",\"changes\":[";
+			for (size_t i = 0; i < changed.size(); i++)
+			{
+				out << (i == 0 ? L"[" : L",[") << changed[i].Tick << L"," << changed[i].Address << L"," << (changed[i].Value ? 1 : 0) << L"]";
+			}
+			out << L"]";
+		}
+		out << L"}" << endl;
+		return 0;
+	}
+};
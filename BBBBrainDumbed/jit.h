@@ -0,0 +1,407 @@
+#pragma once
+#include<stdint.h>
+#include<string.h>
+#include<vector>
+
+#include"blockcache.h"
+
+#if defined(__x86_64__) && defined(__linux__)
+#include<sys/mman.h>
+#define BBB_JIT 1
+#endif
+
+using namespace std;
+
+typedef void (*JitHelper)(void* machine);	//runs one opcode on the machine
+typedef uint32_t (*JitEntry)(void* machine);	//compiled block, returns ticks spent
+
+class JitLayout {	//byte offsets of the machine state the compiled code touches
+public:
+	int32_t Z, X, Y, A, B, D, E, P, V, T, I, J, C, M, inst, CodeVersion;
+	int32_t Registers[16];	//mt*/mf* operands by opcode & 7: N X Y A B D E P
+};
+
+/*
+x86-64 code generator for translated blocks. compiled code keeps the machine pointer in rbx and
+works on the state in place, so the machine stays consistent at every exit.
+register moves, bit and nibble operations, fused nibble loads and adds, shifts, flag operations and branches are emitted inline,
+the remaining opcodes (ldr/str, mtj, mti, mtm) call back into the interpreter.
+*/
+class Jit {
+public:
+	static const size_t Capacity = 1 << 20;	//bytes of executable memory
+
+	Jit() {
+
+	}
+
+	Jit(const Jit&) {	//compiled code belongs to one machine
+
+	}
+
+	Jit& operator=(const Jit&) {
+		reset();
+		return *this;
+	}
+
+	~Jit() {
+#ifdef BBB_JIT
+		if (buffer != nullptr)
+		{
+			munmap(buffer, Capacity);
+		}
+#endif
+	}
+
+	static bool available() {
+#ifdef BBB_JIT
+		return true;
+#else
+		return false;
+#endif
+	}
+
+	void reset() {
+		used = 0;
+	}
+
+	JitEntry compile(const Block& block, const JitLayout& layout, const JitHelper* helpers, uint32_t codeVersion) {	//nullptr if unsupported or out of space
+#ifdef BBB_JIT
+		if (buffer == nullptr)
+		{
+			void* p = mmap(nullptr, Capacity, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+			if (p == MAP_FAILED)
+			{
+				return nullptr;
+			}
+			buffer = (uint8_t*)p;
+		}
+		code.clear();
+		l = &layout;
+		emit(0x53);	//push rbx
+		emit(0x48); emit(0x89); emit(0xfb);	//mov rbx, rdi
+		for (size_t i = 0; i < block.ops.size(); i++)
+		{
+			const MicroOp& op = block.ops[i];
+			if (i + 1 == block.ops.size())
+			{
+				storeImm16(l->P, op.next);
+			}
+			compileOp(op, helpers);
+			if (op.opcode == 29 && i + 1 != block.ops.size())	//str: leave if it modified translated code
+			{
+				emit(0x81); modrm(7, l->CodeVersion); emit32(codeVersion);	//cmp dword [CodeVersion], imm32
+				emit(0x74); emit(9 + 7 + 5 + 2);	//je over the exit
+				storeImm16(l->P, op.next);
+				storeImm8(l->inst, op.opcode);
+				exit(op.ticks);
+			}
+		}
+		storeImm8(l->inst, block.ops.back().lastOpcode());
+		exit(block.ticks);
+		if (used + code.size() > Capacity)
+		{
+			return nullptr;
+		}
+		uint8_t* entry = buffer + used;
+		mprotect(buffer, Capacity, PROT_READ | PROT_WRITE);
+		memcpy(entry, code.data(), code.size());
+		mprotect(buffer, Capacity, PROT_READ | PROT_EXEC);
+		used += (code.size() + 15) & ~(size_t)15;
+		return (JitEntry)entry;
+#else
+		return nullptr;
+#endif
+	}
+
+private:
+	uint8_t* buffer = nullptr;
+	size_t used = 0;
+	vector<uint8_t> code;
+	const JitLayout* l = nullptr;
+
+	void compileOp(const MicroOp& op, const JitHelper* helpers) {
+		uint8_t o = op.opcode;
+		if (o >= 1 && o <= 7)	//mtx..mtp
+		{
+			loadZ();
+			store16(l->Registers[o]);
+		}
+		else if (o == 0)	//nop
+		{
+		}
+		else if (o == 8)	//mfn
+		{
+			storeImm16(l->Z, 0);
+		}
+		else if (o == 15)	//mfp
+		{
+			storeImm16(l->Z, op.next);
+		}
+		else if (o >= 9 && o <= 14)	//mfx..mfe
+		{
+			load16(0, l->Registers[o & 7]);
+			store16(l->Z);
+		}
+		else if (o >= 16 && o <= 20)	//bse, bnt, bor, ban, bxo
+		{
+			load8(1, l->I);
+			bitOf(0, l->X);
+			if (o == 17)
+			{
+				emit(0x83); emit(0xf0); emit(0x01);	//xor eax, 1
+			}
+			else if (o >= 18)
+			{
+				bitOf(2, l->Y);
+				emit(o == 18 ? 0x09 : o == 19 ? 0x21 : 0x31); emit(0xd0);	//or/and/xor eax, edx
+			}
+			insertBitTail();
+		}
+		else if (o == 26)	//ad1
+		{
+			load8(1, l->I);
+			bitOf(0, l->X);
+			bitOf(2, l->Y);
+			emit(0x01); emit(0xd0);	//add eax, edx
+			load8(2, l->C);
+			emit(0x01); emit(0xd0);	//add eax, edx
+			store16(l->T);
+			emit(0x89); emit(0xc2);	//mov edx, eax
+			emit(0xd1); emit(0xea);	//shr edx, 1
+			emit(0x83); emit(0xe2); emit(0x01);	//and edx, 1
+			emit(0x88); modrm(2, l->C);	//mov [C], dl
+			emit(0x83); emit(0xe0); emit(0x01);	//and eax, 1
+			insertBitTail();
+		}
+		else if (o >= 22 && o <= 24)	//shl, shr, asr
+		{
+			load8(1, l->I);
+			if (o != 22)
+			{
+				emit(0x80); emit(0xc1); emit(0x0f);	//add cl, 15
+				emit(0x80); emit(0xe1); emit(0x0f);	//and cl, 0xf
+			}
+			load16(0, l->X);
+			emit(0x66); emit(0xd1); emit(o == 22 ? 0xc0 : 0xc8);	//rol/ror ax, 1
+			store16(l->T);
+			emit(0x0f); emit(0xb3); emit(0xc8);	//btr eax, ecx
+			if (o == 24)
+			{
+				bitOf(2, l->X);
+				emit(0xd3); emit(0xe2);	//shl edx, cl
+				emit(0x09); emit(0xd0);	//or eax, edx
+			}
+			store16(l->Z);
+		}
+		else if (o == 60)	//mtc
+		{
+			load8(1, l->I);
+			bitOf(0, l->Z);
+			emit(0x88); modrm(0, l->C);	//mov [C], al
+		}
+		else if (o == 21)	//not
+		{
+			emit(0x66); emit(0xf7); modrm(2, l->Z);	//not word [Z]
+		}
+		else if (o == 25)	//ror
+		{
+			load16(0, l->X);
+			emit(0x66); emit(0xd1); emit(0xc8);	//ror ax, 1
+			store16(l->Z);
+		}
+		else if (o == 27)	//ad4
+		{
+			load8(1, l->I);	//ecx = I
+			load16(0, l->X);
+			emit(0x66); emit(0xd3); emit(0xc8);	//ror ax, cl
+			emit(0x83); emit(0xe0); emit(0x0f);	//and eax, 0xf
+			load16(2, l->Y);
+			emit(0x66); emit(0xd3); emit(0xca);	//ror dx, cl
+			emit(0x83); emit(0xe2); emit(0x0f);	//and edx, 0xf
+			emit(0x01); emit(0xd0);	//add eax, edx
+			load8(2, l->C);
+			emit(0x01); emit(0xd0);	//add eax, edx
+			emit(0x89); emit(0xc2);	//mov edx, eax
+			emit(0xc1); emit(0xea); emit(0x04);	//shr edx, 4
+			emit(0x83); emit(0xe2); emit(0x01);	//and edx, 1
+			emit(0x88); modrm(2, l->C);	//mov [C], dl
+			emit(0x83); emit(0xe0); emit(0x0f);	//and eax, 0xf
+			load16(2, l->Z);
+			emit(0x66); emit(0xd3); emit(0xca);	//ror dx, cl
+			emit(0x81); emit(0xe2); emit32(0xfff0);	//and edx, 0xfff0
+			emit(0x09); emit(0xd0);	//or eax, edx
+			insertNibbleTail();
+		}
+		else if (o >= 32 && o <= 47)	//ld0..ldf
+		{
+			load8(1, l->I);
+			loadZ();
+			emit(0x66); emit(0xd3); emit(0xc8);	//ror ax, cl
+			emit(0x25); emit32(0xfff0);	//and eax, 0xfff0
+			emit(0x83); emit(0xc8); emit(o - 32);	//or eax, imm8
+			insertNibbleTail();
+		}
+		else if (o == MicroOp::FusedLoad)
+		{
+			load8(1, l->I);
+			emit(0xb8); emit32(op.operand);	//mov eax, imm32
+			emit(0x66); emit(0xd3); emit(0xc0);	//rol ax, cl
+			fusedTail();
+		}
+		else if (o == MicroOp::FusedAdd)
+		{
+			load8(1, l->I);
+			load16(0, l->X);
+			emit(0x66); emit(0xd3); emit(0xc8);	//ror ax, cl
+			load16(2, l->Y);
+			emit(0x66); emit(0xd3); emit(0xca);	//ror dx, cl
+			emit(0x01); emit(0xd0);	//add eax, edx
+			load8(2, l->C);
+			emit(0x01); emit(0xd0);	//add eax, edx
+			emit(0x89); emit(0xc2);	//mov edx, eax
+			emit(0xc1); emit(0xea); emit(0x10);	//shr edx, 16
+			emit(0x88); modrm(2, l->C);	//mov [C], dl
+			emit(0x66); emit(0xd3); emit(0xc0);	//rol ax, cl
+			fusedTail();
+		}
+		else if (o == 48 || o == 49)	//clc, sec
+		{
+			storeImm8(l->C, o - 48);
+		}
+		else if (o == 50 || o == 51)	//clm, sem
+		{
+			storeImm8(l->M, o - 50);
+		}
+		else if (o == 52)	//cli
+		{
+			storeImm8(l->I, 0);
+		}
+		else if (o == 53)	//clj
+		{
+			storeImm8(l->J, 0);
+		}
+		else if (o == 54 || o == 55)	//bzz, bcc. P already holds the fall-through address
+		{
+			if (o == 54)
+			{
+				emit(0x66); emit(0x83); modrm(7, l->Z); emit(0);	//cmp word [Z], 0
+			}
+			else
+			{
+				emit(0x80); modrm(7, l->C); emit(0);	//cmp byte [C], 0
+			}
+			emit(0x75); emit(7 + 7);	//jne over the taken path
+			load16(0, l->A);
+			store16(l->P);
+		}
+		else if (o == 56)	//mtv
+		{
+			loadZ();
+			store16(l->V);
+		}
+		else if (o == 57)	//mfv
+		{
+			load16(0, l->V);
+			store16(l->Z);
+		}
+		else if (o == 31 || o == 59 || o == 61 || o == 63)	//mfj, mfi, mfc, mfm
+		{
+			load8(0, o == 31 ? l->J : o == 59 ? l->I : o == 61 ? l->C : l->M);
+			store16(l->Z);
+		}
+		else
+		{
+			emit(0x48); emit(0x89); emit(0xdf);	//mov rdi, rbx
+			emit(0x48); emit(0xb8); emit64((uint64_t)helpers[o]);	//mov rax, helper
+			emit(0xff); emit(0xd0);	//call rax
+		}
+	}
+
+	void bitOf(uint8_t reg, int32_t offset) {	//reg = bit cl of the word at offset
+		load16(reg, offset);
+		emit(0xd3); emit(0xe8 | reg);	//shr reg, cl
+		emit(0x83); emit(0xe0 | reg); emit(0x01);	//and reg, 1
+	}
+
+	void insertBitTail() {	//eax = new bit, cl = I: set bit I of Z, I += 1
+		load16(2, l->Z);
+		emit(0x0f); emit(0xb3); emit(0xca);	//btr edx, ecx
+		emit(0xd3); emit(0xe0);	//shl eax, cl
+		emit(0x09); emit(0xc2);	//or edx, eax
+		emit(0x66); emit(0x89); modrm(2, l->Z);	//mov [Z], dx
+		emit(0x80); emit(0xc1); emit(0x01);	//add cl, 1
+		emit(0x80); emit(0xe1); emit(0x0f);	//and cl, 0xf
+		emit(0x88); modrm(1, l->I);	//mov [I], cl
+	}
+
+	void insertNibbleTail() {	//eax = T with the new nibble, cl = I: T = eax, Z = rotl(T, I), I += 4
+		store16(l->T);
+		emit(0x66); emit(0xd3); emit(0xc0);	//rol ax, cl
+		store16(l->Z);
+		emit(0x80); emit(0xc1); emit(0x04);	//add cl, 4
+		emit(0x80); emit(0xe1); emit(0x0f);	//and cl, 0xf
+		emit(0x88); modrm(1, l->I);	//mov [I], cl
+	}
+
+	void fusedTail() {	//ax = new Z, cl = I: Z = ax, T = rotr(Z, I + 12). I is unchanged after four nibbles
+		store16(l->Z);
+		emit(0x80); emit(0xc1); emit(0x0c);	//add cl, 12
+		emit(0x80); emit(0xe1); emit(0x0f);	//and cl, 0xf
+		emit(0x66); emit(0xd3); emit(0xc8);	//ror ax, cl
+		store16(l->T);
+	}
+
+	void exit(uint32_t ticks) {
+		emit(0xb8); emit32(ticks);	//mov eax, ticks
+		emit(0x5b);	//pop rbx
+		emit(0xc3);	//ret
+	}
+
+	void loadZ() {
+		load16(0, l->Z);
+	}
+
+	void load16(uint8_t reg, int32_t offset) {	//movzx reg32, word [rbx + offset]
+		emit(0x0f); emit(0xb7); modrm(reg, offset);
+	}
+
+	void load8(uint8_t reg, int32_t offset) {	//movzx reg32, byte [rbx + offset]
+		emit(0x0f); emit(0xb6); modrm(reg, offset);
+	}
+
+	void store16(int32_t offset) {	//mov word [rbx + offset], ax
+		emit(0x66); emit(0x89); modrm(0, offset);
+	}
+
+	void storeImm16(int32_t offset, uint16_t value) {	//9 bytes
+		emit(0x66); emit(0xc7); modrm(0, offset); emit(value & 0xff); emit(value >> 8);
+	}
+
+	void storeImm8(int32_t offset, uint8_t value) {	//7 bytes
+		emit(0xc6); modrm(0, offset); emit(value);
+	}
+
+	void modrm(uint8_t reg, int32_t offset) {	//[rbx + disp32]
+		emit(0x80 | (reg << 3) | 3);
+		emit32((uint32_t)offset);
+	}
+
+	void emit(uint8_t byte) {
+		code.push_back(byte);
+	}
+
+	void emit32(uint32_t value) {
+		for (int i = 0; i < 4; i++)
+		{
+			emit((value >> (i * 8)) & 0xff);
+		}
+	}
+
+	void emit64(uint64_t value) {
+		for (int i = 0; i < 8; i++)
+		{
+			emit((value >> (i * 8)) & 0xff);
+		}
+	}
+};
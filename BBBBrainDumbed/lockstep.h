@@ -0,0 +1,597 @@
+#pragma once
+#include<stdint.h>
+#include<algorithm>
+
+#include"blockcache.h"
+
+#if defined(__AVX2__)
+#include<immintrin.h>
+#endif
+
+using namespace std;
+
+class Lane8 {	//eight 32-bit lanes. AVX2 when the compiler targets it (/arch:AVX2, -mavx2), plain loops otherwise
+public:
+#if defined(__AVX2__)
+	static const bool Wide = true;
+	__m256i v;
+
+	static Lane8 load(const uint32_t* p) {
+		Lane8 r;
+		r.v = _mm256_loadu_si256((const __m256i*)p);
+		return r;
+	}
+
+	void store(uint32_t* p) const {
+		_mm256_storeu_si256((__m256i*)p, v);
+	}
+
+	static Lane8 splat(uint32_t x) {
+		Lane8 r;
+		r.v = _mm256_set1_epi32((int)x);
+		return r;
+	}
+
+	friend Lane8 operator+(Lane8 a, Lane8 b) { a.v = _mm256_add_epi32(a.v, b.v); return a; }
+	friend Lane8 operator&(Lane8 a, Lane8 b) { a.v = _mm256_and_si256(a.v, b.v); return a; }
+	friend Lane8 operator|(Lane8 a, Lane8 b) { a.v = _mm256_or_si256(a.v, b.v); return a; }
+	friend Lane8 operator^(Lane8 a, Lane8 b) { a.v = _mm256_xor_si256(a.v, b.v); return a; }
+	friend Lane8 operator<<(Lane8 a, Lane8 n) { a.v = _mm256_sllv_epi32(a.v, n.v); return a; }
+	friend Lane8 operator>>(Lane8 a, Lane8 n) { a.v = _mm256_srlv_epi32(a.v, n.v); return a; }
+	friend Lane8 operator<<(Lane8 a, int n) { a.v = _mm256_sll_epi32(a.v, _mm_cvtsi32_si128(n)); return a; }
+	friend Lane8 operator>>(Lane8 a, int n) { a.v = _mm256_srl_epi32(a.v, _mm_cvtsi32_si128(n)); return a; }
+
+	static Lane8 andNot(Lane8 a, Lane8 b) {	//a & ~b
+		a.v = _mm256_andnot_si256(b.v, a.v);
+		return a;
+	}
+
+	static Lane8 equal(Lane8 a, Lane8 b) {	//all ones where equal
+		a.v = _mm256_cmpeq_epi32(a.v, b.v);
+		return a;
+	}
+
+	static Lane8 select(Lane8 mask, Lane8 a, Lane8 b) {	//a where mask is set, b elsewhere
+		a.v = _mm256_blendv_epi8(b.v, a.v, mask.v);
+		return a;
+	}
+
+	uint32_t bits() const {	//bit n set if lane n of a mask is set
+		return (uint32_t)_mm256_movemask_ps(_mm256_castsi256_ps(v));
+	}
+#else
+	static const bool Wide = false;	//slower than the scalar core
+	uint32_t v[8];
+
+	static Lane8 load(const uint32_t* p) {
+		Lane8 r;
+		for (int i = 0; i < 8; i++) r.v[i] = p[i];
+		return r;
+	}
+
+	void store(uint32_t* p) const {
+		for (int i = 0; i < 8; i++) p[i] = v[i];
+	}
+
+	static Lane8 splat(uint32_t x) {
+		Lane8 r;
+		for (int i = 0; i < 8; i++) r.v[i] = x;
+		return r;
+	}
+
+	friend Lane8 operator+(Lane8 a, Lane8 b) { for (int i = 0; i < 8; i++) a.v[i] += b.v[i]; return a; }
+	friend Lane8 operator&(Lane8 a, Lane8 b) { for (int i = 0; i < 8; i++) a.v[i] &= b.v[i]; return a; }
+	friend Lane8 operator|(Lane8 a, Lane8 b) { for (int i = 0; i < 8; i++) a.v[i] |= b.v[i]; return a; }
+	friend Lane8 operator^(Lane8 a, Lane8 b) { for (int i = 0; i < 8; i++) a.v[i] ^= b.v[i]; return a; }
+	friend Lane8 operator<<(Lane8 a, Lane8 n) { for (int i = 0; i < 8; i++) a.v[i] = n.v[i] < 32 ? a.v[i] << n.v[i] : 0; return a; }
+	friend Lane8 operator>>(Lane8 a, Lane8 n) { for (int i = 0; i < 8; i++) a.v[i] = n.v[i] < 32 ? a.v[i] >> n.v[i] : 0; return a; }
+	friend Lane8 operator<<(Lane8 a, int n) { for (int i = 0; i < 8; i++) a.v[i] <<= n; return a; }
+	friend Lane8 operator>>(Lane8 a, int n) { for (int i = 0; i < 8; i++) a.v[i] >>= n; return a; }
+
+	static Lane8 andNot(Lane8 a, Lane8 b) {
+		for (int i = 0; i < 8; i++) a.v[i] &= ~b.v[i];
+		return a;
+	}
+
+	static Lane8 equal(Lane8 a, Lane8 b) {
+		for (int i = 0; i < 8; i++) a.v[i] = a.v[i] == b.v[i] ? ~0u : 0;
+		return a;
+	}
+
+	static Lane8 select(Lane8 mask, Lane8 a, Lane8 b) {
+		for (int i = 0; i < 8; i++) a.v[i] = (a.v[i] & mask.v[i]) | (b.v[i] & ~mask.v[i]);
+		return a;
+	}
+
+	uint32_t bits() const {
+		uint32_t out = 0;
+		for (int i = 0; i < 8; i++) out |= (v[i] >> 31) << i;
+		return out;
+	}
+#endif
+};
+
+/*
+runs Lanes machines that share one ROM in lockstep, with their registers stored as structure of arrays.
+lanes at the same P form a group and execute each instruction together, one Lane8 kernel per 8 lanes.
+lanes whose P diverges wait masked off: the group is re-formed around the lane that has spent the fewest ticks,
+so lanes running the same loop converge again.
+ldr/str go to each lane's own Memory. the group is handed to the lanes' scalar cores, which replay blocks until the lanes are back in ROM,
+for code outside the predecoded ROM, for copy loops RunBlocks turns into one transfer and for groups of fewer than Sparse lanes.
+lanes leave lockstep and finish in the scalar core when they write to ROM (their opcode table goes private)
+or run out of whole-instruction budget. a lane an earlier budget stopped mid-instruction finishes it on its scalar core, then joins.
+machines with breakpoints, watchpoints or tracked pages never join.
+Execute gives every machine exactly the state its own Execute would.
+*/
+template<class Machine, size_t Lanes> class Lockstep {
+	static_assert(Lanes % 8 == 0 && Lanes <= 32, "Lanes must be a multiple of 8 up to 32.");
+
+public:
+	Machine* Machines[Lanes] = {};
+	uint64_t Instructions = 0;	//lane instructions executed in lockstep, for measuring throughput
+	bool Vectorized = Lane8::Wide;	//false runs every machine on its own core, as plain Lane8 loops lose to it
+
+	void Execute(size_t count) {	//same as Machines[n]->Execute(count) for every n
+		if (!Vectorized)
+		{
+			for (size_t l = 0; l < Lanes; l++)
+			{
+				Machines[l]->Execute(count);
+			}
+			return;
+		}
+		const uint8_t* table = nullptr;
+		alive = 0;
+		for (size_t l = 0; l < Lanes; l++)
+		{
+			Machine& m = *Machines[l];
+			m.Execute(0);	//fire events already due
+			uint64_t limit = min((uint64_t)count, (uint64_t)0x7fffffff);
+			if (m.events.Next() - m.Tick < limit)
+			{
+				limit = m.events.Next() - m.Tick;
+			}
+			Limit[l] = (uint32_t)limit;
+			Tick[l] = 0;
+			bool able = !m.memory.Debugging() && !m.memory.Tracking();	//stops and change ticks need the machine's own core
+			while (able && m.stage != 1 && Tick[l] < Limit[l])	//finish the instruction a budget cut short, lanes join at stage 1
+			{
+				Tick[l] += (uint32_t)m.Step();
+			}
+			if (table == nullptr && m.stage == 1)
+			{
+				table = m.memory.Opcodes.Data;
+			}
+			if (able && m.stage == 1 && m.memory.Opcodes.Data == table && Limit[l] - Tick[l] >= 10)
+			{
+				alive |= 1u << l;
+			}
+			load(l);
+		}
+		regroup();
+		while (group != 0)
+		{
+			if (handoff || pc > 0x8000 - 6)	//fetch reads each lane's own memory
+			{
+				flush();
+				scalar(table);
+				regroup();
+				continue;
+			}
+			uint8_t opcode = table[pc];
+			pc += 6;
+			uint32_t cost = (opcode >> 1) == 14 ? 10 : 8;
+			spent += cost;
+			steps++;
+			last = opcode;
+			Instructions += population(group);
+			step(opcode);
+			if (left != 0)	//str went to ROM
+			{
+				flush();
+				alive &= ~left;
+				left = 0;
+				regroup();
+			}
+			else if (spent == 0 || slack - spent < 10)	//P written, or a lane may be out of budget
+			{
+				flush();
+				regroup();
+			}
+		}
+		flush();
+		for (size_t l = 0; l < Lanes; l++)
+		{
+			Machine& m = *Machines[l];
+			store(l);
+			m.Tick += Tick[l];
+			m.Execute(count - Tick[l]);	//rest of the budget, and lanes that never joined
+		}
+	}
+
+private:
+	uint32_t Z[Lanes], X[Lanes], Y[Lanes], A[Lanes], B[Lanes], D[Lanes], E[Lanes], P[Lanes], V[Lanes], T[Lanes];
+	uint32_t I[Lanes], J[Lanes], C[Lanes], M[Lanes], IRQ[Lanes], Inst[Lanes], Tick[Lanes], Limit[Lanes];
+	uint32_t Mask[Lanes];	//all ones for lanes in the group
+	uint32_t alive = 0;	//lanes still in lockstep
+	uint32_t group = 0;	//lanes executing the current instruction, all at P == pc
+	uint32_t pending = 0;	//group lanes with an IRQ takeable after every instruction
+	bool handoff = false;	//the group runs faster on the scalar cores, see regroup
+	uint32_t left = 0;	//lanes leaving lockstep after this instruction
+	uint32_t pc = 0;
+	uint32_t spent = 0;	//ticks the group has run since the last flush
+	uint32_t steps = 0;	//instructions the group has run since the last flush
+	uint32_t slack = 0;	//smallest Limit - Tick in the group at the last flush
+	uint8_t last = 0;	//opcode the group executed last
+	static const uint32_t Sparse = Lanes / 4;	//smaller groups run faster on the scalar cores
+	static const size_t Slice = BlockCache::MaxLength * 10;	//ticks of block replay between checks for a lane back in ROM, enough for the longest block
+
+	static uint32_t population(uint32_t bits) {
+		uint32_t n = 0;
+		for (; bits != 0; bits &= bits - 1)
+		{
+			n++;
+		}
+		return n;
+	}
+
+	void load(size_t l) {
+		Machine& m = *Machines[l];
+		Z[l] = m.Z; X[l] = m.X; Y[l] = m.Y; A[l] = m.A; B[l] = m.B; D[l] = m.D; E[l] = m.E;
+		P[l] = m.P; V[l] = m.V; T[l] = m.T; I[l] = m.I; J[l] = m.J; C[l] = m.C; M[l] = m.M;
+		IRQ[l] = m.IRQ ? ~0u : 0;
+		Inst[l] = m.inst;
+	}
+
+	void store(size_t l) {
+		Machine& m = *Machines[l];
+		m.Z = (uint16_t)Z[l]; m.X = (uint16_t)X[l]; m.Y = (uint16_t)Y[l]; m.A = (uint16_t)A[l]; m.B = (uint16_t)B[l];
+		m.D = (uint16_t)D[l]; m.E = (uint16_t)E[l]; m.P = (uint16_t)P[l]; m.V = (uint16_t)V[l]; m.T = (uint16_t)T[l];
+		m.I = (uint8_t)I[l]; m.J = (uint8_t)J[l]; m.C = C[l] != 0; m.M = M[l] != 0;
+		m.inst = (uint8_t)Inst[l];
+	}
+
+	void scalar(const uint8_t* table) {	//group lanes run on their scalar core for a Slice and on until they fetch from ROM again, replaying blocks while no IRQ can be taken. lanes stopping mid-instruction or writing ROM leave
+		for (size_t l = 0; l < Lanes; l++)
+		{
+			if (!(group & (1u << l)))
+			{
+				continue;
+			}
+			Machine& m = *Machines[l];
+			store(l);
+			do
+			{
+				size_t spent = 0;
+				if (!m.IRQ || m.M)
+				{
+					spent = m.RunBlocks(min((size_t)(Limit[l] - Tick[l]), Slice), m.Tick + Tick[l]);	//m.Tick stays where Execute began until the end
+				}
+				if (spent == 0)	//no block fits, or an IRQ to take
+				{
+					do
+					{
+						spent += m.Step();
+					} while (m.stage != 1 && Tick[l] + spent < Limit[l]);
+				}
+				Tick[l] += (uint32_t)spent;
+			} while (m.P > 0x8000 - 6 && m.stage == 1 && m.memory.Opcodes.Data == table && Limit[l] - Tick[l] >= 10);
+			load(l);
+			if (m.stage != 1 || m.memory.Opcodes.Data != table)
+			{
+				alive &= ~(1u << l);
+			}
+		}
+	}
+
+	void flush() {	//hand the group's shared progress back to its lanes
+		if (spent == 0)
+		{
+			return;
+		}
+		for (size_t l = 0; l < Lanes; l++)
+		{
+			if (group & (1u << l))
+			{
+				Tick[l] += spent;
+				P[l] = pc;
+				Inst[l] = last;
+				Machines[l]->Instructions += steps;
+			}
+		}
+		spent = 0;
+		steps = 0;
+	}
+
+	void regroup() {	//picks the lagging lane, gathers every lane at its P. P must be flushed
+		group = 0;
+		uint32_t lead = Lanes;
+		for (size_t l = 0; l < Lanes; l++)
+		{
+			if ((alive & (1u << l)) && Limit[l] - Tick[l] < 10)	//out of whole-instruction budget
+			{
+				alive &= ~(1u << l);
+			}
+			if ((alive & (1u << l)) && (lead == Lanes || Tick[l] < Tick[lead]))
+			{
+				lead = l;
+			}
+		}
+		if (lead == Lanes)
+		{
+			return;
+		}
+		pc = P[lead];
+		Lane8 at = Lane8::splat(pc);
+		for (size_t c = 0; c < Lanes; c += 8)
+		{
+			group |= Lane8::equal(Lane8::load(P + c), at).bits() << c;
+		}
+		group &= alive;
+		handoff = population(group) < Sparse || copies(*Machines[lead], pc, Block::endsBlock((uint8_t)Inst[lead]));
+		slack = ~0u;
+		pending = 0;
+		for (size_t l = 0; l < Lanes; l++)
+		{
+			bool in = (group & (1u << l)) != 0;
+			Mask[l] = in ? ~0u : 0;
+			if (in)
+			{
+				slack = min(slack, Limit[l] - Tick[l]);
+				if (IRQ[l] && !M[l])
+				{
+					pending |= 1u << l;
+				}
+			}
+		}
+	}
+
+	static bool copies(Machine& m, uint32_t at, bool reached) {	//at heads a copy loop the scalar core runs as one transfer. reached: by a branch, else only a block already there is looked at
+		if (at > 0x8000 - 6 || m.blocks.version != m.memory.CodeVersion)	//a stale cache is cleared by the next RunBlocks
+		{
+			return false;
+		}
+		Block* head = m.blocks.find((uint16_t)at);
+		if (head == nullptr && (!reached || (head = m.translate((uint16_t)at)) == nullptr))
+		{
+			return false;
+		}
+		if (head->ops.back().opcode != 54)	//bzz
+		{
+			return false;
+		}
+		if (head->idiom == Idiom::Unchecked)
+		{
+			uint16_t next = head->ops.back().next;
+			if (m.blocks.find(next) == nullptr && m.translate(next) == nullptr)
+			{
+				return false;
+			}
+			head = m.blocks.find((uint16_t)at);	//translating may have moved it
+			head->matchLoop(*m.blocks.find(next));
+		}
+		return head->idiom != Idiom::None;
+	}
+
+	void put(uint32_t* r, size_t c, Lane8 m, Lane8 value) {
+		Lane8::select(m, value, Lane8::load(r + c)).store(r + c);
+	}
+
+	static Lane8 rotr(Lane8 v, Lane8 n) {	//16-bit rotate right by 0-15
+		return ((v >> n) | (v << (Lane8::splat(16) + negate(n)))) & Lane8::splat(0xffff);
+	}
+
+	static Lane8 rotl(Lane8 v, Lane8 n) {
+		return ((v << n) | (v >> (Lane8::splat(16) + negate(n)))) & Lane8::splat(0xffff);
+	}
+
+	static Lane8 negate(Lane8 n) {
+		return (n ^ Lane8::splat(~0u)) + Lane8::splat(1);
+	}
+
+	typedef void (Lockstep::*Kernel)();
+
+	static const Kernel* kernels() {	//kernel<opcode>, so the opcode is dispatched once for all lanes
+		static const Kernel table[64] = {
+			&Lockstep::kernel<0>, &Lockstep::kernel<1>, &Lockstep::kernel<2>, &Lockstep::kernel<3>, &Lockstep::kernel<4>, &Lockstep::kernel<5>, &Lockstep::kernel<6>, &Lockstep::kernel<7>,
+			&Lockstep::kernel<8>, &Lockstep::kernel<9>, &Lockstep::kernel<10>, &Lockstep::kernel<11>, &Lockstep::kernel<12>, &Lockstep::kernel<13>, &Lockstep::kernel<14>, &Lockstep::kernel<15>,
+			&Lockstep::kernel<16>, &Lockstep::kernel<17>, &Lockstep::kernel<18>, &Lockstep::kernel<19>, &Lockstep::kernel<20>, &Lockstep::kernel<21>, &Lockstep::kernel<22>, &Lockstep::kernel<23>,
+			&Lockstep::kernel<24>, &Lockstep::kernel<25>, &Lockstep::kernel<26>, &Lockstep::kernel<27>, &Lockstep::kernel<28>, &Lockstep::kernel<29>, &Lockstep::kernel<30>, &Lockstep::kernel<31>,
+			&Lockstep::kernel<32>, &Lockstep::kernel<33>, &Lockstep::kernel<34>, &Lockstep::kernel<35>, &Lockstep::kernel<36>, &Lockstep::kernel<37>, &Lockstep::kernel<38>, &Lockstep::kernel<39>,
+			&Lockstep::kernel<40>, &Lockstep::kernel<41>, &Lockstep::kernel<42>, &Lockstep::kernel<43>, &Lockstep::kernel<44>, &Lockstep::kernel<45>, &Lockstep::kernel<46>, &Lockstep::kernel<47>,
+			&Lockstep::kernel<48>, &Lockstep::kernel<49>, &Lockstep::kernel<50>, &Lockstep::kernel<51>, &Lockstep::kernel<52>, &Lockstep::kernel<53>, &Lockstep::kernel<54>, &Lockstep::kernel<55>,
+			&Lockstep::kernel<56>, &Lockstep::kernel<57>, &Lockstep::kernel<58>, &Lockstep::kernel<59>, &Lockstep::kernel<60>, &Lockstep::kernel<61>, &Lockstep::kernel<62>, &Lockstep::kernel<63>
+		};
+		return table;
+	}
+
+	template<uint8_t Op> void kernel() {	//Op on every 8 lanes, masked to the group. ldr/str never get here
+		uint32_t* regs[8] = { nullptr, X, Y, A, B, D, E, P };	//mt*/mf* operand by Op & 7
+		const Lane8 one = Lane8::splat(1), nibble = Lane8::splat(0xf), word = Lane8::splat(0xffff);
+		for (size_t c = 0; c < Lanes; c += 8)
+		{
+			Lane8 m = Lane8::load(Mask + c);
+			Lane8 z = Lane8::load(Z + c), x = Lane8::load(X + c), i = Lane8::load(I + c);
+			if (Op == 0)	//nop, mtn
+			{
+			}
+			else if (Op == 7)	//mtp
+			{
+				put(P, c, m, z);
+			}
+			else if (Op < 7)	//mtx..mte
+			{
+				put(regs[Op], c, m, z);
+			}
+			else if (Op == 8)	//mfn
+			{
+				put(Z, c, m, Lane8::splat(0));
+			}
+			else if (Op == 15)	//mfp
+			{
+				put(Z, c, m, Lane8::splat(pc));
+			}
+			else if (Op < 16)	//mfx..mfe
+			{
+				put(Z, c, m, Lane8::load(regs[Op & 7] + c));
+			}
+			else if (Op <= 20 || Op == 26)	//bse, bnt, bor, ban, bxo, ad1
+			{
+				Lane8 bit = (x >> i) & one;
+				Lane8 y = (Lane8::load(Y + c) >> i) & one;
+				if (Op == 17)
+				{
+					bit = bit ^ one;
+				}
+				else if (Op == 18)
+				{
+					bit = bit | y;
+				}
+				else if (Op == 19)
+				{
+					bit = bit & y;
+				}
+				else if (Op == 20)
+				{
+					bit = bit ^ y;
+				}
+				else if (Op == 26)
+				{
+					Lane8 sum = bit + y + Lane8::load(C + c);
+					put(T, c, m, sum);
+					put(C, c, m, (sum >> 1) & one);
+					bit = sum & one;
+				}
+				put(Z, c, m, Lane8::andNot(z, one << i) | (bit << i));
+				put(I, c, m, (i + one) & nibble);
+			}
+			else if (Op == 21)	//not
+			{
+				put(Z, c, m, z ^ word);
+			}
+			else if (Op <= 24)	//shl, shr, asr
+			{
+				Lane8 t = Op == 22 ? ((x << 1) | (x >> 15)) & word : ((x << 15) | (x >> 1)) & word;
+				Lane8 k = Op == 22 ? i : (i + nibble) & nibble;
+				put(T, c, m, t);
+				Lane8 out = Lane8::andNot(t, one << k);
+				if (Op == 24)
+				{
+					out = out | (x & (one << k));
+				}
+				put(Z, c, m, out);
+			}
+			else if (Op == 25)	//ror
+			{
+				put(Z, c, m, ((x << 15) | (x >> 1)) & word);
+			}
+			else if (Op == 27)	//ad4
+			{
+				Lane8 sum = (rotr(x, i) & nibble) + (rotr(Lane8::load(Y + c), i) & nibble) + Lane8::load(C + c);
+				put(C, c, m, (sum >> 4) & one);
+				Lane8 t = Lane8::andNot(rotr(z, i), nibble) | (sum & nibble);
+				put(T, c, m, t);
+				put(Z, c, m, rotl(t, i));
+				put(I, c, m, (i + Lane8::splat(4)) & nibble);
+			}
+			else if (Op == 30 || Op == 58)	//mtj, mti
+			{
+				Lane8 v = ((z << (Lane8::splat(16) + negate(i))) | (x >> i)) & nibble;
+				put(Op == 30 ? J : I, c, m, v);
+			}
+			else if (Op == 31 || Op == 57 || Op == 59 || Op == 61 || Op == 63)	//mfj, mfv, mfi, mfc, mfm
+			{
+				uint32_t* r = Op == 31 ? J : Op == 57 ? V : Op == 59 ? I : Op == 61 ? C : M;
+				put(Z, c, m, Lane8::load(r + c));
+			}
+			else if (Op < 48)	//ld0..ldf
+			{
+				Lane8 t = Lane8::andNot(rotr(z, i), nibble) | Lane8::splat(Op - 32);
+				put(T, c, m, t);
+				put(Z, c, m, rotl(t, i));
+				put(I, c, m, (i + Lane8::splat(4)) & nibble);
+			}
+			else if (Op <= 51)	//clc, sec, clm, sem
+			{
+				put(Op <= 49 ? C : M, c, m, Lane8::splat(Op & 1));
+			}
+			else if (Op == 52 || Op == 53)	//cli, clj
+			{
+				put(Op == 52 ? I : J, c, m, Lane8::splat(0));
+			}
+			else if (Op == 54 || Op == 55)	//bzz, bcc
+			{
+				Lane8 taken = Lane8::equal(Op == 54 ? z : Lane8::load(C + c), Lane8::splat(0)) & m;
+				put(P, c, taken, Lane8::load(A + c));
+			}
+			else if (Op == 56)	//mtv
+			{
+				put(V, c, m, z);
+			}
+			else if (Op == 60 || Op == 62)	//mtc, mtm
+			{
+				put(Op == 60 ? C : M, c, m, (z >> i) & one);
+			}
+		}
+	}
+
+	void step(uint8_t opcode) {	//runs opcode on the group. anything writing P flushes first, which makes Execute regroup
+		if (opcode == 7 || opcode == 54 || opcode == 55)	//mtp, bzz, bcc
+		{
+			flush();
+		}
+		if (opcode == 28 || opcode == 29)	//ldr, str on each lane's memory
+		{
+			for (size_t l = 0; l < Lanes; l++)
+			{
+				if (!(group & (1u << l)))
+				{
+					continue;
+				}
+				Machine& m = *Machines[l];
+				if (opcode == 28)
+				{
+					Z[l] = (Z[l] & ~(1u << J[l])) | ((uint32_t)m.memory.read((uint16_t)A[l]) << J[l]);
+				}
+				else
+				{
+					const uint8_t* before = m.memory.Opcodes.Data;
+					m.memory.write((uint16_t)A[l], (bool)((Z[l] >> J[l]) & 1));
+					if (m.memory.Opcodes.Data != before)
+					{
+						left |= 1u << l;
+					}
+				}
+				J[l] = (J[l] + 1) & 0xf;
+			}
+		}
+		else
+		{
+			(this->*kernels()[opcode])();
+		}
+		if (opcode == 50 || opcode == 51 || opcode == 62)	//M changed, recheck which lanes take IRQs
+		{
+			pending = 0;
+			for (size_t l = 0; l < Lanes; l++)
+			{
+				if ((group & (1u << l)) && IRQ[l] && !M[l])
+				{
+					pending |= 1u << l;
+				}
+			}
+		}
+		if (pending != 0)	//checkIRQ: T = P, P = V, V = T
+		{
+			flush();
+			for (size_t l = 0; l < Lanes; l++)
+			{
+				if (pending & (1u << l))
+				{
+					T[l] = P[l];
+					P[l] = V[l];
+					V[l] = T[l];
+				}
+			}
+		}
+	}
+};
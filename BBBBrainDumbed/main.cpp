@@ -8,183 +8,31 @@
 #include<fstream>
 #include<exception>
 #include<tuple>
+#include<algorithm>
 
+#if defined(_WIN32)
 #include<Windows.h>
+#else
+#include<cassert>
+#define _ASSERT_EXPR(expr, message) assert(expr)
+#endif
 
 #include"instructions.h"
+#include"memory.h"
+#include"blockcache.h"
+#include"jit.h"
+#include"scheduler.h"
+#include"policy.h"
+#include"trace.h"
+#include"batch.h"
+#include"lockstep.h"
+#include"rewind.h"
+#include"movie.h"
+#include"runloop.h"
+#include"headless.h"
 
 using namespace std;
 
-class Memory {
-public:
-
-	bitset<0x8000> ROM;	//0x0000-0x7fff
-	bitset<0x4000> RAM;	//0x8000-0xbfff
-	bitset<0x17> VRAM;	//0xc000-0xc016 0xc017-0xc01f:reserved 0xc020-0xdfff:mirror 
-	bitset<0x5> ARAM;	//0xe000-0xe004 0xe005-0xe007:reserved 0xe008-0xefff:mirror
-	bitset<0x5> ControllerInput0;	//0xf000-0xf004 0xf005-0xf007:reserved
-	bitset<0x5> ControllerInput1;	//0xf008-0xf00c 0xf00d-0xf00f:reserved 0xf010-0xf7ff:mirror
-	//0xf800-0xffff:reserved
-
-	Memory() {
-
-	}
-
-	void BakeRom(vector<bool> input) {
-		if (input.size() > 0x8000)
-		{
-			throw out_of_range("Input is too large.");
-		}
-		for (size_t i = 0; i < input.size(); i++)
-		{
-			ROM[i] = input[i];
-		}
-	}
-
-	uint16_t MapAddress(uint16_t input) {
-		uint16_t output = input;
-		if (input >= 0xc020 && input <= 0xdfff)
-		{
-			//1100 0000 0001 1111
-			//1101 1111 1111 1111
-			output = input & 0xc01f;
-		}
-		else if (input >= 0xe008 && input <= 0xefff)
-		{
-			//1110 0000 0000 0111
-			//1110 1111 1111 1111
-			output = input & 0xe007;
-		}
-		else if (input >= 0xf010 && input <= 0xf7ff)
-		{
-			//1111 0000 0000 1111
-			//1111 0111 1111 1111
-			output = input & 0xf00f;
-		}
-		return output;
-	}
-
-	bool read(uint16_t address) {
-		uint16_t i = MapAddress(address);
-		if (i <= 0x7fff)
-		{
-			return ROM[i];
-		}
-		else if (i <= 0xbfff)
-		{
-			return RAM[i - 0x8000];
-		}
-		else if (i <= 0xc016)
-		{
-			return VRAM[i - 0xc000];
-		}
-		else if (i <= 0xdfff)
-		{
-			return true;
-		}
-		else if (i <= 0xe004)
-		{
-			return ARAM[i - 0xe000];
-		}
-		else if (i <= 0xefff)
-		{
-			return true;
-		}
-		else if (i <= 0xf004)
-		{
-			return ControllerInput0[i - 0xf000];
-		}
-		else if (i <= 0xf007)
-		{
-			return true;
-		}
-		else if (i <= 0xf00c)
-		{
-			return ControllerInput1[i - 0xf008];
-		}
-		else
-		{
-			return true;
-		}
-	}
-
-	uint8_t read6(uint16_t address) {
-		uint8_t out = 0;
-		for (uint8_t i = 0; i < 6; i++)
-		{
-			out |= read(address + i) << i;
-		}
-		return out;
-	}
-
-	uint16_t read16(uint16_t address) {
-		uint16_t out = 0;
-		for (uint8_t i = 0; i < 16; i++)
-		{
-			out |= read(address + i) << i;
-		}
-		return out;
-	}
-
-	void write(uint16_t address, bool value) {
-		uint16_t i = MapAddress(address);
-		if (i <= 0x7fff)
-		{
-			ROM[i] = value;
-		}
-		else if (i <= 0xbfff)
-		{
-			RAM[i - 0x8000] = value;
-		}
-		else if (i <= 0xc016)
-		{
-			VRAM[i - 0xc000] = value;
-		}
-		else if (i <= 0xdfff)
-		{
-			return;
-		}
-		else if (i <= 0xe004)
-		{
-			ARAM[i - 0xe000] = value;
-		}
-		else if (i <= 0xefff)
-		{
-			return;
-		}
-		else if (i <= 0xf004)
-		{
-			ControllerInput0[i - 0xf000] = value;
-		}
-		else if (i <= 0xf007)
-		{
-			return;
-		}
-		else if (i <= 0xf00c)
-		{
-			ControllerInput1[i - 0xf008] = value;
-		}
-		else
-		{
-			return;
-		}
-	}
-
-	void write(uint16_t address, vector<bool> value) {
-		for (uint8_t i = 0; i < value.size(); i++)
-		{
-			write(address + i, value[i]);
-		}
-	}
-
-	void write(uint16_t address, uint16_t value) {
-		for (uint8_t i = 0; i < 16; i++)
-		{
-			write(address + i, (bool)((value >> i) & 1));
-		}
-	}
-};
-
 enum class $TokenType {
 	Default,
 	Label,
@@ -227,6 +75,22 @@ public:
 	uint8_t I = 0, J = 0, inst = 0, stage = 0;
 	bool C = false, M = false, IRQ = false;
 	Memory memory;
+	Engine engine = Engine::Blocks;
+	BlockCache blocks;
+	Jit jit;
+	static const uint32_t JitThreshold = 16;	//replays before a block is compiled
+	uint64_t Tick = 0;	//ticks executed since construction
+	uint64_t Instructions = 0;	//instructions completed since construction
+	Scheduler events;	//fired by Execute when Tick reaches them
+	bool StageStepping = false;	//Execute goes stage by stage, no fast paths
+	function<void(uint64_t, uint16_t, uint8_t)> OnInstruction;	//if set, Execute calls it after every instruction with the tick it was fetched at, its address and opcode
+	TraceBuffer* Recorder = nullptr;	//if set, Execute logs every instruction to it, before OnInstruction, still replaying blocks but not compiled code
+	function<void(uint64_t, uint8_t, uint8_t)> OnInput;	//if set, called with every input as it is applied: the tick it was applied at, which is later than posted for a tick already passed, port and bits
+	uint16_t fetchedAt = 0;	//address and tick of the instruction in flight, kept by traced stepping
+	uint64_t fetchedTick = 0;
+	StopReason Stopped = StopReason::None;	//why the last Execute returned, Tick is where it stopped
+	uint16_t StopAddress = 0;	//breakpoint, or the address a watched bit was written through
+	uint64_t resumed = ~0ull;	//tick of the last breakpoint stop, which does not stop again at that tick so Execute can resume past it. cleared by Restore
 
 	static list<Token>* Tokenizer(wstring input, wstring filename) {
 		size_t parenthesisDepth = 0;
@@ -1311,7 +1175,9 @@ public:
 		return lhs;
 	}
 
-	static vector<bool> Parser(list<Token>* input) {
+	typedef map<uint16_t, Token> DebugMap;	//bit address of every assembled instruction to the Token it came from
+
+	static vector<bool> Parser(list<Token>* input, DebugMap* debug = nullptr) {
 		vector<bool> output;
 		vector<pair<size_t, list<Token>::iterator>> TBR;	//to be resolved. <binary position, directive>
 		list<Token>::iterator i = input->begin();
@@ -1353,6 +1219,10 @@ public:
 			{
 				if (j->second.itype == instructionType::mnemonic)
 				{
+					if (debug != nullptr)
+					{
+						(*debug)[(uint16_t)output.size()] = *i;
+					}
 					for (size_t k = 0; k < j->second.opcode.size(); k++)
 					{
 						output.push_back(j->second.opcode.test(k));
@@ -1366,7 +1236,11 @@ public:
 						wstring filepath = (*i).token;
 						size_t filesize = 0, fileoffset = 0;
 						basic_ifstream<char> ifs;
+#if defined(_WIN32)
 						ifs.open(filepath, ios_base::binary | ios_base::in);
+#else
+						ifs.open(string(filepath.begin(), filepath.end()), ios_base::binary | ios_base::in);	//Headless widens paths byte for byte
+#endif
 						if (ifs.fail())
 						{
 							throw ParserError("failed to open file", *i);
@@ -1398,6 +1272,10 @@ public:
 					}
 					else if (j->first == L"ldi")	//accepts label as value. format: ldi value
 					{
+						for (size_t k = 0; debug != nullptr && k < 4; k++)	//expands to 4 ld*
+						{
+							(*debug)[(uint16_t)(output.size() + 6 * k)] = *i;
+						}
 						TBR.push_back(make_pair(output.size(), i));
 						i++;
 						if (!isParsable(*i, insts))
@@ -1442,564 +1320,1276 @@ public:
 		return output;
 	}
 
-	void Execute(size_t count) {
+	StopReason Execute(size_t count) {	//runs until count ticks have passed or a breakpoint or watchpoint is hit, firing scheduled events at their tick. calling it again resumes
+		uint64_t target = Tick + count;
+		Stopped = StopReason::None;
+		fireEvents();
+		while (Tick < target && Stopped == StopReason::None)
+		{
+			uint64_t until = min(target, events.Next());
+			memory.WatchHit = -1;	//writes by the host and callbacks do not stop
+			Tick += (this->*advancer())((size_t)(until - Tick));
+			fireEvents();
+		}
+		return Stopped;
+	}
+
+	void PostIRQ(uint64_t tick, bool level) {	//sets the IRQ line at tick. taken after the next instruction completing with M clear
+		events.Post(tick, level ? EventType::RaiseIRQ : EventType::LowerIRQ);
+	}
+
+	void PostInput(uint64_t tick, uint8_t port, uint8_t bits) {	//sets ControllerInput0 or 1 to the low 5 bits of bits at tick, seen by every ldr from then on
+		if (port > 1)
+		{
+			throw out_of_range("No such controller port.");
+		}
+		Event event;
+		event.tick = tick;
+		event.type = EventType::Input;
+		event.port = port;
+		event.bits = bits & 0x1f;
+		events.Post(event);
+	}
+
+	static const uint32_t StateMagic = 0x53424242;	//"BBBS"
+	static const uint16_t StateVersion = 3;	//LoadState also reads versions 1 and 2
+
+	vector<uint8_t> SaveState() const {	//registers, Tick, Instructions, queued IRQ events and inputs and memory, see savestate.h. callbacks and the memory map belong to the host and are not saved
+		StateWriter out;
+		out.Put(StateMagic, 4);
+		out.Put(StateVersion, 2);
+		Core().Put(out);
+		memory.SaveState(out);
+		return out.Data;
+	}
+
+	void LoadState(const vector<uint8_t>& state, shared_ptr<const Rom> rom = nullptr) {	//rom must be the image the state was saved with, nullptr keeps the one loaded. queued callbacks are kept
+		StateReader in(state);
+		if (in.Get(4) != StateMagic)
+		{
+			throw invalid_argument("Not a save state.");
+		}
+		uint16_t version = (uint16_t)in.Get(2);
+		if (version == 0 || version > StateVersion)
+		{
+			throw invalid_argument("Unsupported save state version.");
+		}
+		CoreState core = CoreState::Get(in, version);
+		memory.LoadState(in, rom);
+		if (!in.AtEnd())
+		{
+			throw invalid_argument("State has trailing data.");
+		}
+		Restore(core);
+	}
+
+	CoreState Core() const {	//everything but memory
+		CoreState core;
+		core.Z = Z; core.X = X; core.Y = Y; core.A = A; core.B = B; core.D = D; core.E = E; core.P = P; core.V = V; core.T = T;
+		core.I = I; core.J = J; core.inst = inst; core.stage = stage;
+		core.C = C; core.M = M; core.IRQ = IRQ;
+		core.Tick = Tick;
+		core.Instructions = Instructions;
+		vector<Event> queued = events.Queued();
+		for (size_t i = 0; i < queued.size(); i++)
+		{
+			if (queued[i].type == EventType::RaiseIRQ || queued[i].type == EventType::LowerIRQ)
+			{
+				core.Levels.push_back(make_pair(queued[i].tick, queued[i].type == EventType::RaiseIRQ));
+			}
+			else if (queued[i].type == EventType::Input)
+			{
+				core.Inputs.push_back(make_tuple(queued[i].tick, queued[i].port, queued[i].bits));
+			}
+		}
+		return core;
+	}
+
+	void Restore(const CoreState& core) {	//replaces queued IRQ events and inputs, keeps callbacks
+		Z = core.Z; X = core.X; Y = core.Y; A = core.A; B = core.B; D = core.D; E = core.E; P = core.P; V = core.V; T = core.T;
+		I = core.I; J = core.J; inst = core.inst; stage = core.stage;
+		C = core.C; M = core.M; IRQ = core.IRQ;
+		Tick = core.Tick;
+		Instructions = core.Instructions;
+		resumed = ~0ull;	//a restored state stops at its breakpoints again, only an in-place resume steps over one
+		Stopped = StopReason::None;
+		events.Drop(EventType::RaiseIRQ);
+		events.Drop(EventType::LowerIRQ);
+		for (size_t i = 0; i < core.Levels.size(); i++)
+		{
+			PostIRQ(core.Levels[i].first, core.Levels[i].second);
+		}
+		events.Drop(EventType::Input);
+		for (size_t i = 0; i < core.Inputs.size(); i++)
+		{
+			PostInput(get<0>(core.Inputs[i]), get<1>(core.Inputs[i]), get<2>(core.Inputs[i]));
+		}
+	}
+
+	typedef size_t(BBBBrainDumbed::* Advance)(size_t);
+
+	Advance advancer() const {	//advance specialised for the current settings, see policy.h. the IRQ line cannot change until the next event
+		static const Advance table[24] = {
+			&BBBBrainDumbed::advance<TraceOff, IrqNone, InstructionGranular, BreakNone>, &BBBBrainDumbed::advance<TraceOff, IrqNone, StageAccurate, BreakNone>,
+			&BBBBrainDumbed::advance<TraceOff, IrqLine, InstructionGranular, BreakNone>, &BBBBrainDumbed::advance<TraceOff, IrqLine, StageAccurate, BreakNone>,
+			&BBBBrainDumbed::advance<TraceHook, IrqNone, InstructionGranular, BreakNone>, &BBBBrainDumbed::advance<TraceHook, IrqNone, StageAccurate, BreakNone>,
+			&BBBBrainDumbed::advance<TraceHook, IrqLine, InstructionGranular, BreakNone>, &BBBBrainDumbed::advance<TraceHook, IrqLine, StageAccurate, BreakNone>,
+			&BBBBrainDumbed::advance<TraceRing, IrqNone, InstructionGranular, BreakNone>, &BBBBrainDumbed::advance<TraceRing, IrqNone, StageAccurate, BreakNone>,
+			&BBBBrainDumbed::advance<TraceRing, IrqLine, InstructionGranular, BreakNone>, &BBBBrainDumbed::advance<TraceRing, IrqLine, StageAccurate, BreakNone>,
+			&BBBBrainDumbed::advance<TraceOff, IrqNone, InstructionGranular, BreakCheck>, &BBBBrainDumbed::advance<TraceOff, IrqNone, StageAccurate, BreakCheck>,
+			&BBBBrainDumbed::advance<TraceOff, IrqLine, InstructionGranular, BreakCheck>, &BBBBrainDumbed::advance<TraceOff, IrqLine, StageAccurate, BreakCheck>,
+			&BBBBrainDumbed::advance<TraceHook, IrqNone, InstructionGranular, BreakCheck>, &BBBBrainDumbed::advance<TraceHook, IrqNone, StageAccurate, BreakCheck>,
+			&BBBBrainDumbed::advance<TraceHook, IrqLine, InstructionGranular, BreakCheck>, &BBBBrainDumbed::advance<TraceHook, IrqLine, StageAccurate, BreakCheck>,
+			&BBBBrainDumbed::advance<TraceRing, IrqNone, InstructionGranular, BreakCheck>, &BBBBrainDumbed::advance<TraceRing, IrqNone, StageAccurate, BreakCheck>,
+			&BBBBrainDumbed::advance<TraceRing, IrqLine, InstructionGranular, BreakCheck>, &BBBBrainDumbed::advance<TraceRing, IrqLine, StageAccurate, BreakCheck>,
+		};
+		return table[(memory.Debugging() ? 12 : 0) + ((Recorder ? 8 : OnInstruction ? 4 : 0) | (IRQ ? 2 : 0) | (StageStepping ? 1 : 0))];
+	}
+
+	template<class Trace, class Irq, class Granularity, class Break> size_t advance(size_t count) {	//runs until at least count ticks have passed with no event in between, or a stop, returns ticks spent
 		size_t tick = 0;
-		size_t inst_count = 0;
+		Trace::Resync(*this);	//the host or an event may have changed the registers
 		while (tick < count)
 		{
-			switch (stage) {
-			case 0:
-				stage++;
-				tick++;
-				break;
-			case 1:
-				if (P <= (0xf000 - 6))
+			bool whole = !Granularity::Stepped && stage == 1 && (!Irq::Enabled || !IRQ || M);	//nothing can be taken until M is cleared
+			if (whole && Trace::Blocks && !Break::Enabled && engine != Engine::Interpreter)
+			{
+				size_t spent = runBlocks<Trace>(count - tick, Tick + tick);
+				if (spent == 0 && count - tick >= 10)	//no block fits here, interpret one instruction
 				{
-					inst = memory.read6(P);
-					P += 6;
-					stage = 8;
-					tick += 7;
+					spent = run<Trace, BreakNone>(10, Tick + tick);
 				}
-				else
+				if (spent != 0)
 				{
-					P++;
-					stage++;
-					tick++;
-				}
-				break;
-			case 2:
-			case 3:
-			case 4:
-			case 5:
-			case 6:
-				inst |= memory.read(P - 1) << (stage - 2);
-				P++;
-				stage++;
-				tick++;
-				break;
-			case 7:
-				inst |= memory.read(P - 1) << (stage - 2);
-				stage++;
-				tick++;
-				break;
-			case 8:
-				inst_count++;
-				switch (inst)
-				{
-				case 0:	//nop,mtn
-					checkIRQ();
-					stage = 1;
-					tick++;
-					break;
-				case 1:	//mtx
-					X = Z;
-					checkIRQ();
-					stage = 1;
-					tick++;
-					break;
-				case 2:	//mty
-					Y = Z;
-					checkIRQ();
-					stage = 1;
-					tick++;
-					break;
-				case 3:	//mta
-					A = Z;
-					checkIRQ();
-					stage = 1;
-					tick++;
-					break;
-				case 4:	//mtb
-					B = Z;
-					checkIRQ();
-					stage = 1;
-					tick++;
-					break;
-				case 5:	//mtd
-					D = Z;
-					checkIRQ();
-					stage = 1;
-					tick++;
-					break;
-				case 6:	//mte
-					E = Z;
-					checkIRQ();
-					stage = 1;
-					tick++;
-					break;
-				case 7:	//mtp
-					P = Z;
-					checkIRQ();
-					stage = 1;
-					tick++;
-					break;
-				case 8:	//mfn
-					Z = 0;
-					checkIRQ();
-					stage = 1;
-					tick++;
-					break;
-				case 9:	//mfx
-					Z = X;
-					checkIRQ();
-					stage = 1;
-					tick++;
-					break;
-				case 10:	//mfy
-					Z = Y;
-					checkIRQ();
-					stage = 1;
-					tick++;
-					break;
-				case 11:	//mfa
-					Z = A;
-					checkIRQ();
-					stage = 1;
-					tick++;
-					break;
-				case 12:	//mfb
-					Z = B;
-					checkIRQ();
-					stage = 1;
-					tick++;
-					break;
-				case 13:	//mfd
-					Z = D;
-					checkIRQ();
-					stage = 1;
-					tick++;
-					break;
-				case 14:	//mfe
-					Z = E;
-					checkIRQ();
-					stage = 1;
-					tick++;
-					break;
-				case 15:	//mfp
-					Z = P;
-					checkIRQ();
-					stage = 1;
-					tick++;
-					break;
-				case 16:	//bse
-					Z = (uint16_t)bitset<16>(Z).set(I, bitset<16>(X).test(I)).to_ulong();
-					I = (I + 1) & 0xf;
-					checkIRQ();
-					stage = 1;
-					tick++;
-					break;
-				case 17:	//bnt
-					Z = (uint16_t)bitset<16>(Z).set(I, !bitset<16>(X).test(I)).to_ulong();
-					I = (I + 1) & 0xf;
-					checkIRQ();
-					stage = 1;
-					tick++;
-					break;
-				case 18:	//bor
-					Z = (uint16_t)bitset<16>(Z).set(I, bitset<16>(X).test(I) | bitset<16>(Y).test(I)).to_ulong();
-					I = (I + 1) & 0xf;
-					checkIRQ();
-					stage = 1;
-					tick++;
-					break;
-				case 19:	//ban
-					Z = (uint16_t)bitset<16>(Z).set(I, bitset<16>(X).test(I) & bitset<16>(Y).test(I)).to_ulong();
-					I = (I + 1) & 0xf;
-					checkIRQ();
-					stage = 1;
-					tick++;
-					break;
-				case 20:	//bxo
-					Z = (uint16_t)bitset<16>(Z).set(I, bitset<16>(X).test(I) ^ bitset<16>(Y).test(I)).to_ulong();
-					I = (I + 1) & 0xf;
-					checkIRQ();
-					stage = 1;
-					tick++;
-					break;
-				case 21:	//not
-					Z = ~Z;
-					checkIRQ();
-					stage = 1;
-					tick++;
-					break;
-				case 22:	//shl
-					T = (X << 1) | (X >> 15);
-					Z = (uint16_t)bitset<16>(T).reset(I).to_ulong();
-					checkIRQ();
-					stage = 1;
-					tick++;
-					break;
-				case 23:	//shr
-					T = (X << 15) | (X >> 1);
-					Z = (uint16_t)bitset<16>(T).reset((I - 1) & 0xf).to_ulong();
-					checkIRQ();
-					stage = 1;
-					tick++;
-					break;
-				case 24:	//asr
-					T = (X << 15) | (X >> 1);
-					Z = (uint16_t)bitset<16>(T).set((I - 1) & 0xf, bitset<16>(X).test((I - 1) & 0xf)).to_ulong();
-					checkIRQ();
-					stage = 1;
-					tick++;
-					break;
-				case 25:	//ror
-					Z = (X << 15) | (X >> 1);
-					checkIRQ();
-					stage = 1;
-					tick++;
-					break;
-				case 26:	//ad1
-					T = (uint16_t)bitset<16>(X).test(I) + (uint16_t)bitset<16>(Y).test(I) + (uint16_t)C;
-					C = (T & 3) >> 1;
-					Z = (uint16_t)bitset<16>(Z).set(I, (bool)(T & 1)).to_ulong();
-					I = (I + 1) & 0xf;
-					checkIRQ();
-					stage = 1;
-					tick++;
-					break;
-				case 27:	//ad4
-					T = ((X << (16 - I) | X >> I) & 0xf) + ((Y << (16 - I) | Y >> I) & 0xf) + (uint16_t)C;
-					C = (T & 0x10) >> 4;
-					T = T & 0xf;
-					T = ((Z << (16 - I) | Z >> I) & 0xfff0) | T;
-					Z = T << (I) | T >> (16 - I);
-					I = (I + 4) & 0xf;
-					checkIRQ();
-					stage = 1;
-					tick++;
-					break;
-				case 28:	//ldr
-					stage++;
-					tick++;
-					break;
-				case 29:	//str
-					stage++;
-					tick++;
-					break;
-				case 30:	//mtj
-					J = (uint8_t)(((Z << (16 - I)) | (X >> I)) & 0xf);
-					checkIRQ();
-					stage = 1;
-					tick++;
-					break;
-				case 31:	//mfj
-					Z = J;
-					checkIRQ();
-					stage = 1;
-					tick++;
-					break;
-				case 32:	//ld0
-					T = ((Z << (16 - I) | Z >> I) & 0xfff0) | 0x0;
-					Z = T << (I) | T >> (16 - I);
-					I = (I + 4) & 0xf;
-					checkIRQ();
-					stage = 1;
-					tick++;
-					break;
-				case 33:	//ld1
-					T = ((Z << (16 - I) | Z >> I) & 0xfff0) | 0x1;
-					Z = T << (I) | T >> (16 - I);
-					I = (I + 4) & 0xf;
-					checkIRQ();
-					stage = 1;
-					tick++;
-					break;
-				case 34:	//ld2
-					T = ((Z << (16 - I) | Z >> I) & 0xfff0) | 0x2;
-					Z = T << (I) | T >> (16 - I);
-					I = (I + 4) & 0xf;
-					checkIRQ();
-					stage = 1;
-					tick++;
-					break;
-				case 35:	//ld3
-					T = ((Z << (16 - I) | Z >> I) & 0xfff0) | 0x3;
-					Z = T << (I) | T >> (16 - I);
-					I = (I + 4) & 0xf;
-					checkIRQ();
-					stage = 1;
-					tick++;
-					break;
-				case 36:	//ld4
-					T = ((Z << (16 - I) | Z >> I) & 0xfff0) | 0x4;
-					Z = T << (I) | T >> (16 - I);
-					I = (I + 4) & 0xf;
-					checkIRQ();
-					stage = 1;
-					tick++;
-					break;
-				case 37:	//ld5
-					T = ((Z << (16 - I) | Z >> I) & 0xfff0) | 0x5;
-					Z = T << (I) | T >> (16 - I);
-					I = (I + 4) & 0xf;
-					checkIRQ();
-					stage = 1;
-					tick++;
-					break;
-				case 38:	//ld6
-					T = ((Z << (16 - I) | Z >> I) & 0xfff0) | 0x6;
-					Z = T << (I) | T >> (16 - I);
-					I = (I + 4) & 0xf;
-					checkIRQ();
-					stage = 1;
-					tick++;
-					break;
-				case 39:	//ld7
-					T = ((Z << (16 - I) | Z >> I) & 0xfff0) | 0x7;
-					Z = T << (I) | T >> (16 - I);
-					I = (I + 4) & 0xf;
-					checkIRQ();
-					stage = 1;
-					tick++;
-					break;
-				case 40:	//ld8
-					T = ((Z << (16 - I) | Z >> I) & 0xfff0) | 0x8;
-					Z = T << (I) | T >> (16 - I);
-					I = (I + 4) & 0xf;
-					checkIRQ();
-					stage = 1;
-					tick++;
-					break;
-				case 41:	//ld9
-					T = ((Z << (16 - I) | Z >> I) & 0xfff0) | 0x9;
-					Z = T << (I) | T >> (16 - I);
-					I = (I + 4) & 0xf;
-					checkIRQ();
-					stage = 1;
-					tick++;
-					break;
-				case 42:	//lda
-					T = ((Z << (16 - I) | Z >> I) & 0xfff0) | 0xa;
-					Z = T << (I) | T >> (16 - I);
-					I = (I + 4) & 0xf;
-					checkIRQ();
-					stage = 1;
-					tick++;
-					break;
-				case 43:	//ldb
-					T = ((Z << (16 - I) | Z >> I) & 0xfff0) | 0xb;
-					Z = T << (I) | T >> (16 - I);
-					I = (I + 4) & 0xf;
-					checkIRQ();
-					stage = 1;
-					tick++;
-					break;
-				case 44:	//ldc
-					T = ((Z << (16 - I) | Z >> I) & 0xfff0) | 0xc;
-					Z = T << (I) | T >> (16 - I);
-					I = (I + 4) & 0xf;
-					checkIRQ();
-					stage = 1;
-					tick++;
-					break;
-				case 45:	//ldd
-					T = ((Z << (16 - I) | Z >> I) & 0xfff0) | 0xd;
-					Z = T << (I) | T >> (16 - I);
-					I = (I + 4) & 0xf;
-					checkIRQ();
-					stage = 1;
-					tick++;
-					break;
-				case 46:	//lde
-					T = ((Z << (16 - I) | Z >> I) & 0xfff0) | 0xe;
-					Z = T << (I) | T >> (16 - I);
-					I = (I + 4) & 0xf;
-					checkIRQ();
-					stage = 1;
-					tick++;
-					break;
-				case 47:	//ldf
-					T = ((Z << (16 - I) | Z >> I) & 0xfff0) | 0xf;
-					Z = T << (I) | T >> (16 - I);
-					I = (I + 4) & 0xf;
-					checkIRQ();
-					stage = 1;
-					tick++;
-					break;
-				case 48:	//clc
-					C = false;
-					checkIRQ();
-					stage = 1;
-					tick++;
-					break;
-				case 49:	//sec
-					C = true;
-					checkIRQ();
-					stage = 1;
-					tick++;
-					break;
-				case 50:	//clm
-					M = false;
-					checkIRQ();
-					stage = 1;
-					tick++;
-					break;
-				case 51:	//sem
-					M = true;
-					checkIRQ();
-					stage = 1;
-					tick++;
-					break;
-				case 52:	//cli
-					I = 0;
-					checkIRQ();
-					stage = 1;
-					tick++;
-					break;
-				case 53:	//clj
-					J = 0;
-					checkIRQ();
-					stage = 1;
-					tick++;
-					break;
-				case 54:	//bzz
-					if (Z == 0)
-					{
-						P = A;
-					}
-					checkIRQ();
-					stage = 1;
-					tick++;
-					break;
-				case 55:	//bcc
-					if (C == false)
-					{
-						P = A;
-					}
-					checkIRQ();
-					stage = 1;
-					tick++;
-					break;
-				case 56:	//mtv
-					V = Z;
-					checkIRQ();
-					stage = 1;
-					tick++;
-					break;
-				case 57:	//mfv
-					Z = V;
-					checkIRQ();
-					stage = 1;
-					tick++;
-					break;
-				case 58:	//mti
-					I = (uint8_t)(((Z << (16 - I)) | (X >> I)) & 0xf);
-					checkIRQ();
-					stage = 1;
-					tick++;
-					break;
-				case 59:	//mfi
-					Z = I;
-					checkIRQ();
-					stage = 1;
-					tick++;
-					break;
-				case 60:	//mtc
-					C = bitset<16>(Z).test(I);
-					checkIRQ();
-					stage = 1;
-					tick++;
-					break;
-				case 61:	//mfc
-					Z = C;
-					checkIRQ();
-					stage = 1;
-					tick++;
-					break;
-				case 62:	//mtm
-					M = bitset<16>(Z).test(I);
-					checkIRQ();
-					stage = 1;
-					tick++;
-					break;
-				case 63:	//mfm
-					Z = M;
-					checkIRQ();
-					stage = 1;
-					tick++;
-					break;
-				default:
-					_ASSERT_EXPR(false, L"Unreachable condition reached.");
-					break;
+					tick += spent;
+					continue;
 				}
-				break;
-			case 9:
-				switch (inst)
+			}
+			else if (whole && count - tick >= 10)	//whole instructions fit in the budget
+			{
+				size_t spent = run<Trace, Break>(count - tick, Tick + tick);
+				tick += spent;
+				if (Break::Enabled && stopped())
 				{
-				case 28:
-				case 29:
-					stage++;
-					tick++;
-					break;
-				default:
-					wcout << L"inst=" << inst << endl;
-					_ASSERT_EXPR(false,L"Unreachable condition reached.");
 					break;
 				}
-				break;
-			case 10:
-				switch (inst)
-				{
-				case 28:	//ldr
-					Z = (uint16_t)bitset<16>(Z).set(J, memory.read(A)).to_ulong();
-					J = (J + 1) & 0xf;
-					checkIRQ();
-					stage = 1;
-					tick++;
-					break;
-				case 29:	//str
-					memory.write(A, bitset<16>(Z).test(J));
-					J = (J + 1) & 0xf;
-					checkIRQ();
-					stage = 1;
-					tick++;
-					break;
-				default:
-					_ASSERT_EXPR(false, L"Unreachable condition reached.");
-					break;
+				if (spent != 0)
+				{
+					continue;
 				}
-				break;
-			default:
-				_ASSERT_EXPR(false, L"Unreachable condition reached.");
+			}
+			tick += step<Trace, Irq, Break>(Tick + tick);	//stage by stage, delivers a pending IRQ after every instruction
+			if (Break::Enabled && stopped())
+			{
 				break;
 			}
 		}
+		Trace::Flush(*this);
+		return tick;
 	}
 
-	void checkIRQ() {
-		if (!M && IRQ)
+	bool breaks(uint64_t now) {	//P holds a breakpoint to stop at, now is the tick the fetch would start at
+		if (now == resumed || !memory.IsBreakpoint(P))
 		{
-			T = P;
-			P = V;
-			V = T;
+			return false;
 		}
+		Stopped = StopReason::Breakpoint;
+		StopAddress = P;
+		resumed = now;
+		return true;
 	}
-};
 
-int wmain(int argc, wchar_t* argv[], wchar_t* envp[]) {
-	wstring exepath, filepath;
-	basic_ifstream<wchar_t> ifs;
-	if (argc >= 2)
-	{
-		ifs.open(argv[1]);
-		filepath = argv[1];
-		if (ifs.fail())
+	bool stopped() {	//a breakpoint or a watched write stopped the core
+		if (Stopped == StopReason::None && memory.WatchHit >= 0)
 		{
-			return 2;
+			Stopped = StopReason::Watchpoint;
+			StopAddress = (uint16_t)memory.WatchHit;
 		}
-		
-	}
-	else
-	{
-		return 1;
+		return Stopped != StopReason::None;
 	}
-	istreambuf_iterator<wchar_t> ifsbegin(ifs), ifsend;
-	wstring finput(ifsbegin,ifsend);
-	ifs.close();
-	list<Token>* tokens = BBBBrainDumbed::Tokenizer(finput, filepath);
-	BBBBrainDumbed::CheckTokenError(*tokens);
-	vector<bool> ROM;
+
+	void fireEvents() {
+		while (events.Next() <= Tick)
+		{
+			Event event = events.Pop();
+			if (event.type == EventType::RaiseIRQ)
+			{
+				IRQ = true;
+			}
+			else if (event.type == EventType::LowerIRQ)
+			{
+				IRQ = false;
+			}
+			else if (event.type == EventType::Input)
+			{
+				memory.Clock = Tick;
+				memory.write((uint16_t)(event.port != 0 ? 0xf008 : 0xf000), (uint64_t)event.bits, 5);
+				if (OnInput)
+				{
+					OnInput(Tick, event.port, event.bits);
+				}
+			}
+			else if (event.action)
+			{
+				event.action();
+			}
+		}
+	}
+
+	size_t RunBlocks(size_t budget, uint64_t now) {	//replays translated blocks from stage 1 while no IRQ can be taken, returns ticks spent. now is the tick it starts at
+		return runBlocks<TraceOff>(budget, now);
+	}
+
+	template<class Trace> size_t runBlocks(size_t budget, uint64_t now) {	//RunBlocks handing what it runs to Trace, which leaves compiled code alone
+		size_t tick = 0;
+#if defined(__GNUC__)
+		static void* const labels[66] = {
+			&&r_nop, &&r_mtx, &&r_mty, &&r_mta, &&r_mtb, &&r_mtd, &&r_mte, &&r_mtp,
+			&&r_mfn, &&r_mfx, &&r_mfy, &&r_mfa, &&r_mfb, &&r_mfd, &&r_mfe, &&r_mfp,
+			&&r_bse, &&r_bnt, &&r_bor, &&r_ban, &&r_bxo, &&r_not, &&r_shl, &&r_shr,
+			&&r_asr, &&r_ror, &&r_ad1, &&r_ad4, &&r_ldr, &&r_str, &&r_mtj, &&r_mfj,
+			&&r_ld0, &&r_ld1, &&r_ld2, &&r_ld3, &&r_ld4, &&r_ld5, &&r_ld6, &&r_ld7,
+			&&r_ld8, &&r_ld9, &&r_lda, &&r_ldb, &&r_ldc, &&r_ldd, &&r_lde, &&r_ldf,
+			&&r_clc, &&r_sec, &&r_clm, &&r_sem, &&r_cli, &&r_clj, &&r_bzz, &&r_bcc,
+			&&r_mtv, &&r_mfv, &&r_mti, &&r_mfi, &&r_mtc, &&r_mfc, &&r_mtm, &&r_mfm,
+			&&r_ld16, &&r_ad16
+		};
+#endif
+		const Block* previous = nullptr;
+		bool head = Block::endsBlock(inst);	//P was reached by a branch or the end of a block, so a block translated there does not overlap one cut short by a budget
+		const Block* spin = nullptr;	//self-looping block whose registers were saved in before
+		auto before = spinState();
+		uint32_t reads = 0;
+		while (!IRQ || M)	//blocks end at every clm/mtm, so checkIRQ is a no-op inside them
+		{
+			if (blocks.version != memory.CodeVersion)
+			{
+				blocks.clear();
+				jit.reset();
+				memory.ClearCode();
+				blocks.version = memory.CodeVersion;
+			}
+			Block* block = blocks.find(P);
+			if (block == nullptr)
+			{
+				block = head ? translate(P) : nullptr;
+				if (block == nullptr)	//the interpreter runs on to the next head
+				{
+					break;
+				}
+				previous = nullptr;	//translating may have moved the other blocks
+			}
+			head = true;
+			if (budget - tick < block->ticks)
+			{
+				break;
+			}
+			if (block == previous && block->pure)	//looped back to itself
+			{
+				if (spin == block && spinState() == before && memory.DeviceReads == reads)	//the last lap changed nothing, nor will the rest until an event
+				{
+					size_t laps = (budget - tick) / block->ticks;
+					tick += laps * block->ticks;
+					Instructions += laps * block->ops.back().count;
+					Trace::Repeated(*this, laps);
+					continue;
+				}
+				spin = block;
+				before = spinState();
+				reads = memory.DeviceReads;
+			}
+			else
+			{
+				spin = nullptr;
+			}
+			previous = block;
+			if (block->ops.back().opcode == 54)	//bzz, may head a copy loop
+			{
+				Trace::Enter(*this, now + tick);
+				uint8_t j = J;
+				uint64_t counted = Instructions;
+				size_t spent = runLoop(*block, budget - tick);
+				if (spent != 0)
+				{
+					Trace::Looped(*this, *block, *blocks.find(block->ops.back().next), Instructions - counted, (uint16_t)(B >> j));	//what the ldr of LoadBits read
+					tick += spent;
+					checkIRQ<Trace>();
+					continue;
+				}
+			}
+			if (!Trace::Enabled && engine == Engine::Jit && Jit::available() && block->code == nullptr && ++block->uses == JitThreshold)
+			{
+				block->code = (void*)jit.compile(*block, jitLayout(), jitHelpers(), blocks.version);
+				if (block->code == nullptr)	//out of executable memory, start over
+				{
+					jit.reset();
+					blocks.clear();
+					memory.ClearCode();
+					continue;
+				}
+			}
+			if (!Trace::Enabled && block->code != nullptr && (block->pure || !memory.Tracking()))	//compiled str cannot stamp Memory::Clock
+			{
+				size_t spent = ((JitEntry)block->code)(this);
+				tick += spent;
+				Instructions += block->countAt((uint32_t)spent);
+				checkIRQ();
+				continue;
+			}
+			Trace::Enter(*this, now + tick);
+			const MicroOp* op = &block->ops[0];
+			const MicroOp* end = op + block->ops.size();
+#if defined(__GNUC__)
+		replay:
+			if (op != end)
+			{
+				P = op->next;
+				inst = op->opcode;
+				op++;
+				goto *labels[inst];
+			}
+			goto replayed;
+		r_nop: opNop(); goto replay;
+		r_mtx: opMtx(); goto replay;
+		r_mty: opMty(); goto replay;
+		r_mta: opMta(); goto replay;
+		r_mtb: opMtb(); goto replay;
+		r_mtd: opMtd(); goto replay;
+		r_mte: opMte(); goto replay;
+		r_mtp: opMtp(); goto replay;
+		r_mfn: opMfn(); goto replay;
+		r_mfx: opMfx(); goto replay;
+		r_mfy: opMfy(); goto replay;
+		r_mfa: opMfa(); goto replay;
+		r_mfb: opMfb(); goto replay;
+		r_mfd: opMfd(); goto replay;
+		r_mfe: opMfe(); goto replay;
+		r_mfp: opMfp(); goto replay;
+		r_bse: opBse(); goto replay;
+		r_bnt: opBnt(); goto replay;
+		r_bor: opBor(); goto replay;
+		r_ban: opBan(); goto replay;
+		r_bxo: opBxo(); goto replay;
+		r_not: opNot(); goto replay;
+		r_shl: opShl(); goto replay;
+		r_shr: opShr(); goto replay;
+		r_asr: opAsr(); goto replay;
+		r_ror: opRor(); goto replay;
+		r_ad1: opAd1(); goto replay;
+		r_ad4: opAd4(); goto replay;
+		r_ldr: opLdr(); Trace::Read(*this); goto replay;
+		r_str: memory.Clock = now + tick + op[-1].ticks - 1; opStr(); if (memory.CodeVersion != blocks.version) goto replayed; goto replay;	//str hit translated code, rest of the block may be stale
+		r_mtj: opMtj(); goto replay;
+		r_mfj: opMfj(); goto replay;
+		r_ld0: opLd0(); goto replay;
+		r_ld1: opLd1(); goto replay;
+		r_ld2: opLd2(); goto replay;
+		r_ld3: opLd3(); goto replay;
+		r_ld4: opLd4(); goto replay;
+		r_ld5: opLd5(); goto replay;
+		r_ld6: opLd6(); goto replay;
+		r_ld7: opLd7(); goto replay;
+		r_ld8: opLd8(); goto replay;
+		r_ld9: opLd9(); goto replay;
+		r_lda: opLda(); goto replay;
+		r_ldb: opLdb(); goto replay;
+		r_ldc: opLdc(); goto replay;
+		r_ldd: opLdd(); goto replay;
+		r_lde: opLde(); goto replay;
+		r_ldf: opLdf(); goto replay;
+		r_clc: opClc(); goto replay;
+		r_sec: opSec(); goto replay;
+		r_clm: opClm(); goto replay;
+		r_sem: opSem(); goto replay;
+		r_cli: opCli(); goto replay;
+		r_clj: opClj(); goto replay;
+		r_bzz: opBzz(); goto replay;
+		r_bcc: opBcc(); goto replay;
+		r_mtv: opMtv(); goto replay;
+		r_mfv: opMfv(); goto replay;
+		r_mti: opMti(); goto replay;
+		r_mfi: opMfi(); goto replay;
+		r_mtc: opMtc(); goto replay;
+		r_mfc: opMfc(); goto replay;
+		r_mtm: opMtm(); goto replay;
+		r_mfm: opMfm(); goto replay;
+		r_ld16: opLd16(op[-1].operand); inst = op[-1].lastOpcode(); goto replay;
+		r_ad16: opAd16(); inst = 27; goto replay;
+		replayed:
+#else
+			while (op != end)
+			{
+				P = op->next;
+				inst = op->opcode;
+				memory.Clock = now + tick + op->ticks - 1;
+				if (inst == MicroOp::FusedLoad)
+				{
+					opLd16(op->operand);
+				}
+				else if (inst == MicroOp::FusedAdd)
+				{
+					opAd16();
+				}
+				else
+				{
+					dispatch(inst);
+					if (inst == 28)
+					{
+						Trace::Read(*this);
+					}
+				}
+				inst = op->lastOpcode();
+				op++;
+				if (inst == 29 && memory.CodeVersion != blocks.version)	//str hit translated code, rest of the block may be stale
+				{
+					break;
+				}
+			}
+#endif
+			tick += op[-1].ticks;
+			Instructions += op[-1].count;
+			Trace::Replayed(*this, *block, op[-1].count);
+			checkIRQ<Trace>();
+		}
+		return tick;
+	}
+
+	size_t runLoop(Block& head, size_t budget) {	//runs the rest of a recognised copy loop as one transfer, returns ticks spent or 0 to replay normally
+		if (head.idiom == Idiom::Unchecked)
+		{
+			const Block* tail = blocks.find(head.ops.back().next);
+			if (tail == nullptr)	//not reached yet, check again next time
+			{
+				return 0;
+			}
+			head.matchLoop(*tail);
+		}
+		if (head.idiom == Idiom::None || I != 0 || Y != 0)
+		{
+			return 0;
+		}
+		uint8_t n = 16 - J;	//iterations until J wraps to 0
+		size_t lap = head.ticks + head.tailTicks;
+		uint8_t k = n;
+		if (budget < (n - 1) * lap + head.ticks)	//stop at the loop head once the budget runs out
+		{
+			k = (uint8_t)min(budget / lap, (size_t)(n - 1));
+		}
+		if (k == 0)
+		{
+			return 0;
+		}
+		uint16_t next;	//A after k increments
+		bool carry;
+		if (head.idiom == Idiom::LoadBits)	//16-bit increment
+		{
+			if (!memory.isStorage(A, k))	//MMIO, keep bit-by-bit order
+			{
+				return 0;
+			}
+			next = A + k;
+			carry = (uint32_t)A + k > 0xffff;
+			uint16_t mask = (uint16_t)(((1u << k) - 1) << J);
+			B = (B & ~mask) | (uint16_t)(memory.read(A, k) << J);
+		}
+		else	//increment wraps within the low nibble
+		{
+			if ((A & 0xf) + k > 16 || !memory.isStorage(A, k) || memory.Pages[memory.MapAddress(A) >> 8].code || memory.Pages[A >> 8].tracked)	//tracked writes need their own ticks
+			{
+				return 0;
+			}
+			next = (A & 0xfff0) | ((A + k) & 0xf);
+			carry = (A & 0xf) + k > 0xf;
+			memory.write(A, (uint64_t)(B >> J), k);
+		}
+		J = (J + k) & 0xf;
+		X = next;
+		C = carry;
+		if (k == n)	//left through the bzz
+		{
+			A = head.exit;
+			Z = 0;
+			T = (uint16_t)(head.exit >> 12 | head.exit << 4);
+			P = head.exit;
+			inst = 54;
+			Instructions += (k - 1) * (head.ops.back().count + head.tailCount) + head.ops.back().count;
+			return (k - 1) * lap + head.ticks;
+		}
+		A = next;
+		Z = head.start;
+		T = (uint16_t)(head.start >> 12 | head.start << 4);
+		P = head.start;
+		inst = 7;
+		Instructions += k * (head.ops.back().count + head.tailCount);
+		return k * lap;
+	}
+
+	tuple<uint16_t, uint16_t, uint16_t, uint16_t, uint16_t, uint16_t, uint16_t, uint16_t, uint16_t, uint16_t, uint8_t, uint8_t, bool, bool> spinState() const {	//everything a pure block depends on besides memory
+		return make_tuple(Z, X, Y, A, B, D, E, P, V, T, I, J, C, M);
+	}
+
+	Block* translate(uint16_t start) {	//nullptr if no instruction at start can be translated
+		Block block;
+		block.start = start;
+		uint16_t p = start;
+		while (block.ops.size() < BlockCache::MaxLength && p <= 0xf000 - 6 && memory.isFlat(p, 6))
+		{
+			MicroOp op;
+			op.opcode = memory.fetch(p);
+			p += 6;
+			op.next = p;
+			op.count = (uint16_t)(block.ops.empty() ? 1 : block.ops.back().count + 1);
+			block.ticks += ticks(op.opcode);
+			op.ticks = block.ticks;
+			block.ops.push_back(op);
+			block.opcodes.push_back(op.opcode);
+			block.pure = block.pure && op.opcode != 29;
+			block.fuse();
+			if (Block::endsBlock(op.opcode))
+			{
+				break;
+			}
+		}
+		if (block.ops.empty())
+		{
+			return nullptr;
+		}
+		memory.MarkCode(start, p - 1);
+		return blocks.insert(block);
+	}
+
+	size_t Run(size_t budget) {	//threaded core. executes whole instructions from stage 1 while the longest one (ldr/str, 10 ticks) fits in budget and no IRQ can be taken, returns ticks spent
+		return run<TraceOff, BreakNone>(budget, Tick);
+	}
+
+	template<class Trace, class Break> size_t run(size_t budget, uint64_t now) {	//Run under policies, now is the tick it starts at. stops before a breakpoint and after a watched write
+		size_t tick = 0;
+#if defined(__GNUC__)
+		static void* const labels[64] = {
+			&&l_nop, &&l_mtx, &&l_mty, &&l_mta, &&l_mtb, &&l_mtd, &&l_mte, &&l_mtp,
+			&&l_mfn, &&l_mfx, &&l_mfy, &&l_mfa, &&l_mfb, &&l_mfd, &&l_mfe, &&l_mfp,
+			&&l_bse, &&l_bnt, &&l_bor, &&l_ban, &&l_bxo, &&l_not, &&l_shl, &&l_shr,
+			&&l_asr, &&l_ror, &&l_ad1, &&l_ad4, &&l_ldr, &&l_str, &&l_mtj, &&l_mfj,
+			&&l_ld0, &&l_ld1, &&l_ld2, &&l_ld3, &&l_ld4, &&l_ld5, &&l_ld6, &&l_ld7,
+			&&l_ld8, &&l_ld9, &&l_lda, &&l_ldb, &&l_ldc, &&l_ldd, &&l_lde, &&l_ldf,
+			&&l_clc, &&l_sec, &&l_clm, &&l_sem, &&l_cli, &&l_clj, &&l_bzz, &&l_bcc,
+			&&l_mtv, &&l_mfv, &&l_mti, &&l_mfi, &&l_mtc, &&l_mfc, &&l_mtm, &&l_mfm
+		};
+		uint16_t address = P;
+	next:
+		if (Trace::Enabled && tick != 0)	//the instruction just completed
+		{
+			Trace::Record(*this, now + tick - ticks(inst), address, inst);
+		}
+		if (budget - tick < 10 || P > 0xf000 - 6 || (Break::Enabled && memory.Pages[P >> 8].breakpoint && breaks(now + tick)))
+		{
+			return tick;
+		}
+		address = P;
+		inst = memory.fetch(P);
+		P += 6;
+		Instructions++;
+		goto *labels[inst];
+	l_nop: opNop(); tick += 8; goto next;
+	l_mtx: opMtx(); tick += 8; goto next;
+	l_mty: opMty(); tick += 8; goto next;
+	l_mta: opMta(); tick += 8; goto next;
+	l_mtb: opMtb(); tick += 8; goto next;
+	l_mtd: opMtd(); tick += 8; goto next;
+	l_mte: opMte(); tick += 8; goto next;
+	l_mtp: opMtp(); tick += 8; goto next;
+	l_mfn: opMfn(); tick += 8; goto next;
+	l_mfx: opMfx(); tick += 8; goto next;
+	l_mfy: opMfy(); tick += 8; goto next;
+	l_mfa: opMfa(); tick += 8; goto next;
+	l_mfb: opMfb(); tick += 8; goto next;
+	l_mfd: opMfd(); tick += 8; goto next;
+	l_mfe: opMfe(); tick += 8; goto next;
+	l_mfp: opMfp(); tick += 8; goto next;
+	l_bse: opBse(); tick += 8; goto next;
+	l_bnt: opBnt(); tick += 8; goto next;
+	l_bor: opBor(); tick += 8; goto next;
+	l_ban: opBan(); tick += 8; goto next;
+	l_bxo: opBxo(); tick += 8; goto next;
+	l_not: opNot(); tick += 8; goto next;
+	l_shl: opShl(); tick += 8; goto next;
+	l_shr: opShr(); tick += 8; goto next;
+	l_asr: opAsr(); tick += 8; goto next;
+	l_ror: opRor(); tick += 8; goto next;
+	l_ad1: opAd1(); tick += 8; goto next;
+	l_ad4: opAd4(); tick += 8; goto next;
+	l_ldr: opLdr(); tick += 10; goto next;
+	l_str: memory.Clock = now + tick + 9; opStr(); tick += 10; if (Break::Enabled && memory.WatchHit >= 0) goto taken; goto next;	//taken is a no-op for IRQs after str
+	l_mtj: opMtj(); tick += 8; goto next;
+	l_mfj: opMfj(); tick += 8; goto next;
+	l_ld0: opLd0(); tick += 8; goto next;
+	l_ld1: opLd1(); tick += 8; goto next;
+	l_ld2: opLd2(); tick += 8; goto next;
+	l_ld3: opLd3(); tick += 8; goto next;
+	l_ld4: opLd4(); tick += 8; goto next;
+	l_ld5: opLd5(); tick += 8; goto next;
+	l_ld6: opLd6(); tick += 8; goto next;
+	l_ld7: opLd7(); tick += 8; goto next;
+	l_ld8: opLd8(); tick += 8; goto next;
+	l_ld9: opLd9(); tick += 8; goto next;
+	l_lda: opLda(); tick += 8; goto next;
+	l_ldb: opLdb(); tick += 8; goto next;
+	l_ldc: opLdc(); tick += 8; goto next;
+	l_ldd: opLdd(); tick += 8; goto next;
+	l_lde: opLde(); tick += 8; goto next;
+	l_ldf: opLdf(); tick += 8; goto next;
+	l_clc: opClc(); tick += 8; goto next;
+	l_sec: opSec(); tick += 8; goto next;
+	l_clm: opClm(); tick += 8; if (IRQ) goto taken; goto next;	//only clm and mtm can make an IRQ takeable
+	l_sem: opSem(); tick += 8; goto next;
+	l_cli: opCli(); tick += 8; goto next;
+	l_clj: opClj(); tick += 8; goto next;
+	l_bzz: opBzz(); tick += 8; goto next;
+	l_bcc: opBcc(); tick += 8; goto next;
+	l_mtv: opMtv(); tick += 8; goto next;
+	l_mfv: opMfv(); tick += 8; goto next;
+	l_mti: opMti(); tick += 8; goto next;
+	l_mfi: opMfi(); tick += 8; goto next;
+	l_mtc: opMtc(); tick += 8; goto next;
+	l_mfc: opMfc(); tick += 8; goto next;
+	l_mtm: opMtm(); tick += 8; if (!M && IRQ) goto taken; goto next;
+	l_mfm: opMfm(); tick += 8; goto next;
+	taken:
+		if (Trace::Enabled)
+		{
+			Trace::Record(*this, now + tick - ticks(inst), address, inst);
+		}
+		checkIRQ<Trace>();
+		return tick;
+#else
+		return interpret<Trace, IrqLine, Break>(budget, now);
+#endif
+	}
+
+	template<class Trace, class Irq, class Break> size_t interpret(size_t budget, uint64_t now) {	//Run without computed goto, now is the tick it starts at
+		size_t tick = 0;
+		while (budget - tick >= 10 && P <= 0xf000 - 6 && !(Break::Enabled && memory.Pages[P >> 8].breakpoint && breaks(now + tick)))
+		{
+			uint16_t address = P;
+			inst = memory.fetch(P);
+			P += 6;
+			memory.Clock = now + tick + 9;	//str writes in its last stage
+			dispatch(inst);
+			Instructions++;
+			Trace::Record(*this, now + tick, address, inst);
+			tick += ticks(inst);
+			if (Irq::Enabled && !M && IRQ)	//clm or mtm made an IRQ takeable
+			{
+				checkIRQ<Trace>();
+				break;
+			}
+			if (Break::Enabled && memory.WatchHit >= 0)
+			{
+				break;
+			}
+		}
+		return tick;
+	}
+
+	size_t Step() {	//advances the stage machine by one stage, returns ticks spent
+		return step<TraceOff, IrqLine, BreakNone>(Tick);
+	}
+
+	template<class Trace, class Irq, class Break> size_t step(uint64_t now) {	//Step under policies, now is the tick the stage starts at. 0 for a breakpoint at P
+		switch (stage) {
+		case 0:
+			stage++;
+			return 1;
+		case 1:
+			if (Break::Enabled && memory.Pages[P >> 8].breakpoint && breaks(now))
+			{
+				return 0;
+			}
+			if (Trace::Enabled)
+			{
+				fetchedAt = P;
+				fetchedTick = now;
+			}
+			if (P <= (0xf000 - 6))
+			{
+				inst = memory.fetch(P);
+				P += 6;
+				stage = 8;
+				return 7;
+			}
+			else
+			{
+				P++;
+				stage++;
+				return 1;
+			}
+		case 2:
+		case 3:
+		case 4:
+		case 5:
+		case 6:
+			inst |= memory.read(P - 1) << (stage - 2);
+			P++;
+			stage++;
+			return 1;
+		case 7:
+			inst |= memory.read(P - 1) << (stage - 2);
+			stage++;
+			return 1;
+		case 8:
+			if (ticks(inst) > 8)	//ldr, str
+			{
+				stage++;
+				return 1;
+			}
+			(this->*handlers()[inst])();
+			Instructions++;
+			Trace::Record(*this, fetchedTick, fetchedAt, inst);
+			if (Irq::Enabled)
+			{
+				checkIRQ<Trace>();
+			}
+			stage = 1;
+			return 1;
+		case 9:
+			stage++;
+			return 1;
+		case 10:
+			memory.Clock = now;
+			(this->*handlers()[inst])();
+			Instructions++;
+			Trace::Record(*this, fetchedTick, fetchedAt, inst);
+			if (Irq::Enabled)
+			{
+				checkIRQ<Trace>();
+			}
+			stage = 1;
+			return 1;
+		default:
+			_ASSERT_EXPR(false, L"Unreachable condition reached.");
+			return 1;
+		}
+	}
+
+	void dispatch(uint8_t opcode) {	//switch compiles to a jump table indexed by opcode
+		switch (opcode)
+		{
+		case 0: opNop(); break;
+		case 1: opMtx(); break;
+		case 2: opMty(); break;
+		case 3: opMta(); break;
+		case 4: opMtb(); break;
+		case 5: opMtd(); break;
+		case 6: opMte(); break;
+		case 7: opMtp(); break;
+		case 8: opMfn(); break;
+		case 9: opMfx(); break;
+		case 10: opMfy(); break;
+		case 11: opMfa(); break;
+		case 12: opMfb(); break;
+		case 13: opMfd(); break;
+		case 14: opMfe(); break;
+		case 15: opMfp(); break;
+		case 16: opBse(); break;
+		case 17: opBnt(); break;
+		case 18: opBor(); break;
+		case 19: opBan(); break;
+		case 20: opBxo(); break;
+		case 21: opNot(); break;
+		case 22: opShl(); break;
+		case 23: opShr(); break;
+		case 24: opAsr(); break;
+		case 25: opRor(); break;
+		case 26: opAd1(); break;
+		case 27: opAd4(); break;
+		case 28: opLdr(); break;
+		case 29: opStr(); break;
+		case 30: opMtj(); break;
+		case 31: opMfj(); break;
+		case 32: opLd0(); break;
+		case 33: opLd1(); break;
+		case 34: opLd2(); break;
+		case 35: opLd3(); break;
+		case 36: opLd4(); break;
+		case 37: opLd5(); break;
+		case 38: opLd6(); break;
+		case 39: opLd7(); break;
+		case 40: opLd8(); break;
+		case 41: opLd9(); break;
+		case 42: opLda(); break;
+		case 43: opLdb(); break;
+		case 44: opLdc(); break;
+		case 45: opLdd(); break;
+		case 46: opLde(); break;
+		case 47: opLdf(); break;
+		case 48: opClc(); break;
+		case 49: opSec(); break;
+		case 50: opClm(); break;
+		case 51: opSem(); break;
+		case 52: opCli(); break;
+		case 53: opClj(); break;
+		case 54: opBzz(); break;
+		case 55: opBcc(); break;
+		case 56: opMtv(); break;
+		case 57: opMfv(); break;
+		case 58: opMti(); break;
+		case 59: opMfi(); break;
+		case 60: opMtc(); break;
+		case 61: opMfc(); break;
+		case 62: opMtm(); break;
+		case 63: opMfm(); break;
+		default:
+			_ASSERT_EXPR(false, L"Unreachable condition reached.");
+			break;
+		}
+	}
+
+	typedef void (BBBBrainDumbed::*Handler)();
+
+	JitLayout jitLayout() {
+		JitLayout l;
+		char* base = (char*)this;
+		l.Z = (int32_t)((char*)&Z - base);
+		l.X = (int32_t)((char*)&X - base);
+		l.Y = (int32_t)((char*)&Y - base);
+		l.A = (int32_t)((char*)&A - base);
+		l.B = (int32_t)((char*)&B - base);
+		l.D = (int32_t)((char*)&D - base);
+		l.E = (int32_t)((char*)&E - base);
+		l.P = (int32_t)((char*)&P - base);
+		l.V = (int32_t)((char*)&V - base);
+		l.T = (int32_t)((char*)&T - base);
+		l.I = (int32_t)((char*)&I - base);
+		l.J = (int32_t)((char*)&J - base);
+		l.C = (int32_t)((char*)&C - base);
+		l.M = (int32_t)((char*)&M - base);
+		l.inst = (int32_t)((char*)&inst - base);
+		l.CodeVersion = (int32_t)((char*)&memory.CodeVersion - base);
+		int32_t registers[8] = { 0, l.X, l.Y, l.A, l.B, l.D, l.E, l.P };
+		for (size_t i = 0; i < 16; i++)
+		{
+			l.Registers[i] = registers[i & 7];
+		}
+		return l;
+	}
+
+	template<void (BBBBrainDumbed::*op)()> static void jitHelper(void* machine) {
+		(static_cast<BBBBrainDumbed*>(machine)->*op)();
+	}
+
+	static const JitHelper* jitHelpers() {	//indexed by opcode
+		static const JitHelper table[64] = {
+			&jitHelper<&BBBBrainDumbed::opNop>, &jitHelper<&BBBBrainDumbed::opMtx>, &jitHelper<&BBBBrainDumbed::opMty>, &jitHelper<&BBBBrainDumbed::opMta>,
+			&jitHelper<&BBBBrainDumbed::opMtb>, &jitHelper<&BBBBrainDumbed::opMtd>, &jitHelper<&BBBBrainDumbed::opMte>, &jitHelper<&BBBBrainDumbed::opMtp>,
+			&jitHelper<&BBBBrainDumbed::opMfn>, &jitHelper<&BBBBrainDumbed::opMfx>, &jitHelper<&BBBBrainDumbed::opMfy>, &jitHelper<&BBBBrainDumbed::opMfa>,
+			&jitHelper<&BBBBrainDumbed::opMfb>, &jitHelper<&BBBBrainDumbed::opMfd>, &jitHelper<&BBBBrainDumbed::opMfe>, &jitHelper<&BBBBrainDumbed::opMfp>,
+			&jitHelper<&BBBBrainDumbed::opBse>, &jitHelper<&BBBBrainDumbed::opBnt>, &jitHelper<&BBBBrainDumbed::opBor>, &jitHelper<&BBBBrainDumbed::opBan>,
+			&jitHelper<&BBBBrainDumbed::opBxo>, &jitHelper<&BBBBrainDumbed::opNot>, &jitHelper<&BBBBrainDumbed::opShl>, &jitHelper<&BBBBrainDumbed::opShr>,
+			&jitHelper<&BBBBrainDumbed::opAsr>, &jitHelper<&BBBBrainDumbed::opRor>, &jitHelper<&BBBBrainDumbed::opAd1>, &jitHelper<&BBBBrainDumbed::opAd4>,
+			&jitHelper<&BBBBrainDumbed::opLdr>, &jitHelper<&BBBBrainDumbed::opStr>, &jitHelper<&BBBBrainDumbed::opMtj>, &jitHelper<&BBBBrainDumbed::opMfj>,
+			&jitHelper<&BBBBrainDumbed::opLd0>, &jitHelper<&BBBBrainDumbed::opLd1>, &jitHelper<&BBBBrainDumbed::opLd2>, &jitHelper<&BBBBrainDumbed::opLd3>,
+			&jitHelper<&BBBBrainDumbed::opLd4>, &jitHelper<&BBBBrainDumbed::opLd5>, &jitHelper<&BBBBrainDumbed::opLd6>, &jitHelper<&BBBBrainDumbed::opLd7>,
+			&jitHelper<&BBBBrainDumbed::opLd8>, &jitHelper<&BBBBrainDumbed::opLd9>, &jitHelper<&BBBBrainDumbed::opLda>, &jitHelper<&BBBBrainDumbed::opLdb>,
+			&jitHelper<&BBBBrainDumbed::opLdc>, &jitHelper<&BBBBrainDumbed::opLdd>, &jitHelper<&BBBBrainDumbed::opLde>, &jitHelper<&BBBBrainDumbed::opLdf>,
+			&jitHelper<&BBBBrainDumbed::opClc>, &jitHelper<&BBBBrainDumbed::opSec>, &jitHelper<&BBBBrainDumbed::opClm>, &jitHelper<&BBBBrainDumbed::opSem>,
+			&jitHelper<&BBBBrainDumbed::opCli>, &jitHelper<&BBBBrainDumbed::opClj>, &jitHelper<&BBBBrainDumbed::opBzz>, &jitHelper<&BBBBrainDumbed::opBcc>,
+			&jitHelper<&BBBBrainDumbed::opMtv>, &jitHelper<&BBBBrainDumbed::opMfv>, &jitHelper<&BBBBrainDumbed::opMti>, &jitHelper<&BBBBrainDumbed::opMfi>,
+			&jitHelper<&BBBBrainDumbed::opMtc>, &jitHelper<&BBBBrainDumbed::opMfc>, &jitHelper<&BBBBrainDumbed::opMtm>, &jitHelper<&BBBBrainDumbed::opMfm>
+		};
+		return table;
+	}
+
+	static const Handler* handlers() {	//indexed by opcode
+		static const Handler table[64] = {
+			&BBBBrainDumbed::opNop, &BBBBrainDumbed::opMtx, &BBBBrainDumbed::opMty, &BBBBrainDumbed::opMta,
+			&BBBBrainDumbed::opMtb, &BBBBrainDumbed::opMtd, &BBBBrainDumbed::opMte, &BBBBrainDumbed::opMtp,
+			&BBBBrainDumbed::opMfn, &BBBBrainDumbed::opMfx, &BBBBrainDumbed::opMfy, &BBBBrainDumbed::opMfa,
+			&BBBBrainDumbed::opMfb, &BBBBrainDumbed::opMfd, &BBBBrainDumbed::opMfe, &BBBBrainDumbed::opMfp,
+			&BBBBrainDumbed::opBse, &BBBBrainDumbed::opBnt, &BBBBrainDumbed::opBor, &BBBBrainDumbed::opBan,
+			&BBBBrainDumbed::opBxo, &BBBBrainDumbed::opNot, &BBBBrainDumbed::opShl, &BBBBrainDumbed::opShr,
+			&BBBBrainDumbed::opAsr, &BBBBrainDumbed::opRor, &BBBBrainDumbed::opAd1, &BBBBrainDumbed::opAd4,
+			&BBBBrainDumbed::opLdr, &BBBBrainDumbed::opStr, &BBBBrainDumbed::opMtj, &BBBBrainDumbed::opMfj,
+			&BBBBrainDumbed::opLd0, &BBBBrainDumbed::opLd1, &BBBBrainDumbed::opLd2, &BBBBrainDumbed::opLd3,
+			&BBBBrainDumbed::opLd4, &BBBBrainDumbed::opLd5, &BBBBrainDumbed::opLd6, &BBBBrainDumbed::opLd7,
+			&BBBBrainDumbed::opLd8, &BBBBrainDumbed::opLd9, &BBBBrainDumbed::opLda, &BBBBrainDumbed::opLdb,
+			&BBBBrainDumbed::opLdc, &BBBBrainDumbed::opLdd, &BBBBrainDumbed::opLde, &BBBBrainDumbed::opLdf,
+			&BBBBrainDumbed::opClc, &BBBBrainDumbed::opSec, &BBBBrainDumbed::opClm, &BBBBrainDumbed::opSem,
+			&BBBBrainDumbed::opCli, &BBBBrainDumbed::opClj, &BBBBrainDumbed::opBzz, &BBBBrainDumbed::opBcc,
+			&BBBBrainDumbed::opMtv, &BBBBrainDumbed::opMfv, &BBBBrainDumbed::opMti, &BBBBrainDumbed::opMfi,
+			&BBBBrainDumbed::opMtc, &BBBBrainDumbed::opMfc, &BBBBrainDumbed::opMtm, &BBBBrainDumbed::opMfm
+		};
+		return table;
+	}
+
+	static uint8_t ticks(uint8_t opcode) {	//stage 1 to stage 1, including the 7-tick fetch
+		return (opcode >> 1) == 14 ? 10 : 8;
+	}
+
+	void opNop() {	//nop,mtn
+	}
+
+	void opMtx() {	//mtx
+		X = Z;
+	}
+
+	void opMty() {	//mty
+		Y = Z;
+	}
+
+	void opMta() {	//mta
+		A = Z;
+	}
+
+	void opMtb() {	//mtb
+		B = Z;
+	}
+
+	void opMtd() {	//mtd
+		D = Z;
+	}
+
+	void opMte() {	//mte
+		E = Z;
+	}
+
+	void opMtp() {	//mtp
+		P = Z;
+	}
+
+	void opMfn() {	//mfn
+		Z = 0;
+	}
+
+	void opMfx() {	//mfx
+		Z = X;
+	}
+
+	void opMfy() {	//mfy
+		Z = Y;
+	}
+
+	void opMfa() {	//mfa
+		Z = A;
+	}
+
+	void opMfb() {	//mfb
+		Z = B;
+	}
+
+	void opMfd() {	//mfd
+		Z = D;
+	}
+
+	void opMfe() {	//mfe
+		Z = E;
+	}
+
+	void opMfp() {	//mfp
+		Z = P;
+	}
+
+	void opBse() {	//bse
+		Z = (uint16_t)bitset<16>(Z).set(I, bitset<16>(X).test(I)).to_ulong();
+		I = (I + 1) & 0xf;
+	}
+
+	void opBnt() {	//bnt
+		Z = (uint16_t)bitset<16>(Z).set(I, !bitset<16>(X).test(I)).to_ulong();
+		I = (I + 1) & 0xf;
+	}
+
+	void opBor() {	//bor
+		Z = (uint16_t)bitset<16>(Z).set(I, bitset<16>(X).test(I) | bitset<16>(Y).test(I)).to_ulong();
+		I = (I + 1) & 0xf;
+	}
+
+	void opBan() {	//ban
+		Z = (uint16_t)bitset<16>(Z).set(I, bitset<16>(X).test(I) & bitset<16>(Y).test(I)).to_ulong();
+		I = (I + 1) & 0xf;
+	}
+
+	void opBxo() {	//bxo
+		Z = (uint16_t)bitset<16>(Z).set(I, bitset<16>(X).test(I) ^ bitset<16>(Y).test(I)).to_ulong();
+		I = (I + 1) & 0xf;
+	}
+
+	void opNot() {	//not
+		Z = ~Z;
+	}
+
+	void opShl() {	//shl
+		T = (X << 1) | (X >> 15);
+		Z = (uint16_t)bitset<16>(T).reset(I).to_ulong();
+	}
+
+	void opShr() {	//shr
+		T = (X << 15) | (X >> 1);
+		Z = (uint16_t)bitset<16>(T).reset((I - 1) & 0xf).to_ulong();
+	}
+
+	void opAsr() {	//asr
+		T = (X << 15) | (X >> 1);
+		Z = (uint16_t)bitset<16>(T).set((I - 1) & 0xf, bitset<16>(X).test((I - 1) & 0xf)).to_ulong();
+	}
+
+	void opRor() {	//ror
+		Z = (X << 15) | (X >> 1);
+	}
+
+	void opAd1() {	//ad1
+		T = (uint16_t)bitset<16>(X).test(I) + (uint16_t)bitset<16>(Y).test(I) + (uint16_t)C;
+		C = (T & 3) >> 1;
+		Z = (uint16_t)bitset<16>(Z).set(I, (bool)(T & 1)).to_ulong();
+		I = (I + 1) & 0xf;
+	}
+
+	void opAd4() {	//ad4
+		T = ((X << (16 - I) | X >> I) & 0xf) + ((Y << (16 - I) | Y >> I) & 0xf) + (uint16_t)C;
+		C = (T & 0x10) >> 4;
+		T = T & 0xf;
+		T = ((Z << (16 - I) | Z >> I) & 0xfff0) | T;
+		Z = T << (I) | T >> (16 - I);
+		I = (I + 4) & 0xf;
+	}
+
+	void opLd16(uint16_t value) {	//ld* x4, value holds the nibbles in load order. I ends where it started
+		Z = (uint16_t)(value << I | value >> (16 - I));
+		T = (uint16_t)(Z << (16 - ((I + 12) & 0xf)) | Z >> ((I + 12) & 0xf));
+	}
+
+	void opAd16() {	//ad4 x4 as one 16-bit add with carry
+		uint32_t sum = (uint32_t)(uint16_t)(X << (16 - I) | X >> I) + (uint16_t)(Y << (16 - I) | Y >> I) + C;
+		C = (sum >> 16) & 1;
+		Z = (uint16_t)((uint16_t)sum << I | (uint16_t)sum >> (16 - I));
+		T = (uint16_t)(Z << (16 - ((I + 12) & 0xf)) | Z >> ((I + 12) & 0xf));
+	}
+
+	void opLdr() {	//ldr
+		Z = (uint16_t)bitset<16>(Z).set(J, memory.read(A)).to_ulong();
+		J = (J + 1) & 0xf;
+	}
+
+	void opStr() {	//str
+		memory.write(A, bitset<16>(Z).test(J));
+		J = (J + 1) & 0xf;
+	}
+
+	void opMtj() {	//mtj
+		J = (uint8_t)(((Z << (16 - I)) | (X >> I)) & 0xf);
+	}
+
+	void opMfj() {	//mfj
+		Z = J;
+	}
+
+	void opLd0() {	//ld0
+		T = ((Z << (16 - I) | Z >> I) & 0xfff0) | 0x0;
+		Z = T << (I) | T >> (16 - I);
+		I = (I + 4) & 0xf;
+	}
+
+	void opLd1() {	//ld1
+		T = ((Z << (16 - I) | Z >> I) & 0xfff0) | 0x1;
+		Z = T << (I) | T >> (16 - I);
+		I = (I + 4) & 0xf;
+	}
+
+	void opLd2() {	//ld2
+		T = ((Z << (16 - I) | Z >> I) & 0xfff0) | 0x2;
+		Z = T << (I) | T >> (16 - I);
+		I = (I + 4) & 0xf;
+	}
+
+	void opLd3() {	//ld3
+		T = ((Z << (16 - I) | Z >> I) & 0xfff0) | 0x3;
+		Z = T << (I) | T >> (16 - I);
+		I = (I + 4) & 0xf;
+	}
+
+	void opLd4() {	//ld4
+		T = ((Z << (16 - I) | Z >> I) & 0xfff0) | 0x4;
+		Z = T << (I) | T >> (16 - I);
+		I = (I + 4) & 0xf;
+	}
+
+	void opLd5() {	//ld5
+		T = ((Z << (16 - I) | Z >> I) & 0xfff0) | 0x5;
+		Z = T << (I) | T >> (16 - I);
+		I = (I + 4) & 0xf;
+	}
+
+	void opLd6() {	//ld6
+		T = ((Z << (16 - I) | Z >> I) & 0xfff0) | 0x6;
+		Z = T << (I) | T >> (16 - I);
+		I = (I + 4) & 0xf;
+	}
+
+	void opLd7() {	//ld7
+		T = ((Z << (16 - I) | Z >> I) & 0xfff0) | 0x7;
+		Z = T << (I) | T >> (16 - I);
+		I = (I + 4) & 0xf;
+	}
+
+	void opLd8() {	//ld8
+		T = ((Z << (16 - I) | Z >> I) & 0xfff0) | 0x8;
+		Z = T << (I) | T >> (16 - I);
+		I = (I + 4) & 0xf;
+	}
+
+	void opLd9() {	//ld9
+		T = ((Z << (16 - I) | Z >> I) & 0xfff0) | 0x9;
+		Z = T << (I) | T >> (16 - I);
+		I = (I + 4) & 0xf;
+	}
+
+	void opLda() {	//lda
+		T = ((Z << (16 - I) | Z >> I) & 0xfff0) | 0xa;
+		Z = T << (I) | T >> (16 - I);
+		I = (I + 4) & 0xf;
+	}
+
+	void opLdb() {	//ldb
+		T = ((Z << (16 - I) | Z >> I) & 0xfff0) | 0xb;
+		Z = T << (I) | T >> (16 - I);
+		I = (I + 4) & 0xf;
+	}
+
+	void opLdc() {	//ldc
+		T = ((Z << (16 - I) | Z >> I) & 0xfff0) | 0xc;
+		Z = T << (I) | T >> (16 - I);
+		I = (I + 4) & 0xf;
+	}
+
+	void opLdd() {	//ldd
+		T = ((Z << (16 - I) | Z >> I) & 0xfff0) | 0xd;
+		Z = T << (I) | T >> (16 - I);
+		I = (I + 4) & 0xf;
+	}
+
+	void opLde() {	//lde
+		T = ((Z << (16 - I) | Z >> I) & 0xfff0) | 0xe;
+		Z = T << (I) | T >> (16 - I);
+		I = (I + 4) & 0xf;
+	}
+
+	void opLdf() {	//ldf
+		T = ((Z << (16 - I) | Z >> I) & 0xfff0) | 0xf;
+		Z = T << (I) | T >> (16 - I);
+		I = (I + 4) & 0xf;
+	}
+
+	void opClc() {	//clc
+		C = false;
+	}
+
+	void opSec() {	//sec
+		C = true;
+	}
+
+	void opClm() {	//clm
+		M = false;
+	}
+
+	void opSem() {	//sem
+		M = true;
+	}
+
+	void opCli() {	//cli
+		I = 0;
+	}
+
+	void opClj() {	//clj
+		J = 0;
+	}
+
+	void opBzz() {	//bzz
+		if (Z == 0)
+		{
+			P = A;
+		}
+	}
+
+	void opBcc() {	//bcc
+		if (C == false)
+		{
+			P = A;
+		}
+	}
+
+	void opMtv() {	//mtv
+		V = Z;
+	}
+
+	void opMfv() {	//mfv
+		Z = V;
+	}
+
+	void opMti() {	//mti
+		I = (uint8_t)(((Z << (16 - I)) | (X >> I)) & 0xf);
+	}
+
+	void opMfi() {	//mfi
+		Z = I;
+	}
+
+	void opMtc() {	//mtc
+		C = bitset<16>(Z).test(I);
+	}
+
+	void opMfc() {	//mfc
+		Z = C;
+	}
+
+	void opMtm() {	//mtm
+		M = bitset<16>(Z).test(I);
+	}
+
+	void opMfm() {	//mfm
+		Z = M;
+	}
+
+	void checkIRQ() {
+		if (!M && IRQ)
+		{
+			T = P;
+			P = V;
+			V = T;
+		}
+	}
+
+	template<class Trace> void checkIRQ() {	//checkIRQ telling a trace policy
+		if (Trace::Enabled && !M && IRQ)
+		{
+			Trace::Taken(*this);
+		}
+		checkIRQ();
+	}
+};
+
+#if defined(_WIN32)
+int wmain(int argc, wchar_t* argv[], wchar_t* envp[]) {
+	wstring exepath, filepath;
+	basic_ifstream<wchar_t> ifs;
+	if (argc >= 2)
+	{
+		ifs.open(argv[1]);
+		filepath = argv[1];
+		if (ifs.fail())
+		{
+			return 2;
+		}
+		
+	}
+	else
+	{
+		return 1;
+	}
+	istreambuf_iterator<wchar_t> ifsbegin(ifs), ifsend;
+	wstring finput(ifsbegin,ifsend);
+	ifs.close();
+	list<Token>* tokens = BBBBrainDumbed::Tokenizer(finput, filepath);
+	BBBBrainDumbed::CheckTokenError(*tokens);
+	vector<bool> ROM;
 	try
 	{
 		ROM = BBBBrainDumbed::Parser(tokens);
@@ -2022,6 +2612,16 @@ int wmain(int argc, wchar_t* argv[], wchar_t* envp[]) {
 	b.C = 1;
 	b.A = 0x8000;
 	b.memory.write(0x8000, (uint16_t)52149);
+	if (argc >= 3)	//frames [turbo]: frame-paced run at RunLoop's default rate, reporting speed against real time
+	{
+		RunLoop<BBBBrainDumbed> loop;
+		loop.Turbo = argc >= 4 && wstring(argv[3]) == L"turbo";
+		b.P = 0;
+		loop.Run(b, stoull(argv[2]));
+		wcout << L"Z=" << b.Z << L" X=" << b.X << L" Y=" << b.Y << L" C=" << b.C << L" B=" << b.B << L" P=" << b.P << L" (0x8000)=" << b.memory.read16(0x8000) << endl;
+		wcout << loop.Frames << L" frames " << loop.Elapsed << L"s speed " << loop.Speed() << L"x max lateness " << loop.MaxLateness * 1000 << L"ms" << endl;
+		return 0;
+	}
 	LARGE_INTEGER qpc0, qpc1, qpf;
 	QueryPerformanceFrequency(&qpf);
 	QueryPerformanceCounter(&qpc0);
@@ -2034,4 +2634,9 @@ int wmain(int argc, wchar_t* argv[], wchar_t* envp[]) {
 	wcout << L"Z=" << b.Z << L" X=" << b.X << L" Y=" << b.Y << L" C=" << b.C << L" B=" << b.B << L" P=" << b.P << L" (0x8000)=" << b.memory.read16(0x8000) << endl;
 	wcout << (double)(qpc1.QuadPart - qpc0.QuadPart) / qpf.QuadPart << endl;
 	return 0;
-}
\ No newline at end of file
+}
+#else
+int main(int argc, char* argv[]) {
+	return Headless<BBBBrainDumbed>::Run(argc, argv, wcout);
+}
+#endif
@@ -0,0 +1,643 @@
+#pragma once
+#include<stdint.h>
+#include<vector>
+#include<stdexcept>
+#include<memory>
+#include<functional>
+#include<algorithm>
+
+#include"savestate.h"
+
+using namespace std;
+
+class Device {	//memory-mapped peripheral, receives absolute bit addresses of the pages it is mapped to
+public:
+	virtual ~Device() {}
+	virtual bool read(uint16_t address) = 0;
+	virtual void write(uint16_t address, bool value) = 0;
+};
+
+class Region {
+public:
+	uint16_t mask = 0xffff;	//applied to the address before accessing Bits, for mirrored windows
+	Device* device = nullptr;	//handles every access to the page when set
+	bool code = false;	//holds translated code, writes bump Memory::CodeVersion
+	bool breakpoint = false;	//holds a breakpoint, fetches from it check Memory::Breakpoints
+	bool watch = false;	//maps onto a watched bit, writes to it check Memory::Watchpoints
+	bool tracked = false;	//writes changing a bit through it are reported as a MemoryChange
+
+	bool isFlat() const {
+		return mask == 0xffff && device == nullptr;
+	}
+};
+
+class MemoryChange {	//a tracked bit flipped by a write
+public:
+	uint64_t Tick = 0;	//Memory::Clock at the write, the tick of the last stage of the str
+	uint16_t Address = 0;	//storage address, the same for every mirror
+	bool Value = false;	//new value
+};
+
+class Rom {	//immutable ROM image with its predecoded opcodes, shared read-only by every machine loaded from it
+public:
+	uint64_t Bits[0x200];	//0x0000-0x7fff, same layout as Memory::Bits
+	uint8_t Opcodes[0x8000 - 5];	//6-bit opcode starting at every ROM bit address 0x0000-0x7ffa
+	uint64_t Hash = 0;	//of Bits, how save states refer to the image
+
+	explicit Rom(const vector<bool>& input) {
+		if (input.size() > 0x8000)
+		{
+			throw out_of_range("Input is too large.");
+		}
+		for (size_t i = 0; i < 0x200; i++)
+		{
+			Bits[i] = 0;
+		}
+		for (size_t i = 0; i < input.size(); i++)
+		{
+			if (input[i])
+			{
+				Bits[i >> 6] |= 1ull << (i & 63);
+			}
+		}
+		for (size_t i = 0; i <= 0x8000 - 6; i++)
+		{
+			uint64_t word = Bits[i >> 6] >> (i & 63);
+			if ((i & 63) > 64 - 6)
+			{
+				word |= Bits[(i >> 6) + 1] << (64 - (i & 63));
+			}
+			Opcodes[i] = word & 0x3f;
+		}
+		Hash = StateHash(Bits, 0x200);
+	}
+
+	static shared_ptr<const Rom> Blank() {	//all zero, what a new Memory starts with
+		static const shared_ptr<const Rom> blank = make_shared<Rom>(vector<bool>());
+		return blank;
+	}
+};
+
+class OpcodeTable {	//points at a shared Rom::Opcodes until the machine writes to ROM, then at a private copy
+public:
+	const uint8_t* Data = nullptr;
+
+	OpcodeTable() {
+		Share(Rom::Blank());
+	}
+
+	OpcodeTable(const OpcodeTable& other) : image(other.image), own(other.own) {
+		Data = own.empty() ? image->Opcodes : own.data();
+	}
+
+	OpcodeTable& operator=(const OpcodeTable& other) {
+		image = other.image;
+		own = other.own;
+		Data = own.empty() ? image->Opcodes : own.data();
+		return *this;
+	}
+
+	void Share(shared_ptr<const Rom> rom) {
+		image = rom;
+		own.clear();
+		own.shrink_to_fit();
+		Data = image->Opcodes;
+	}
+
+	uint8_t* Writable() {
+		if (own.empty())
+		{
+			own.assign(Data, Data + sizeof(image->Opcodes));
+			Data = own.data();
+		}
+		return own.data();
+	}
+
+	bool IsShared() const {
+		return own.empty();
+	}
+
+	shared_ptr<const Rom> Image() const {	//the ROM last shared, even once the table went private
+		return image;
+	}
+
+private:
+	shared_ptr<const Rom> image;
+	vector<uint8_t> own;
+};
+
+class Memory {
+public:
+	/*
+	memory map (bit addresses):
+		0x0000-0x7fff ROM
+		0x8000-0xbfff RAM
+		0xc000-0xc016 VRAM 0xc017-0xc01f:reserved 0xc020-0xdfff:mirror
+		0xe000-0xe004 ARAM 0xe005-0xe007:reserved 0xe008-0xefff:mirror
+		0xf000-0xf004 ControllerInput0 0xf005-0xf007:reserved
+		0xf008-0xf00c ControllerInput1 0xf00d-0xf00f:reserved 0xf010-0xf7ff:mirror
+		0xf800-0xffff reserved
+	reserved bits read as 1 and ignore writes.
+	every 0x100-bit page is a Region: flat storage in Bits, optionally mirrored, or a Device.
+	breakpoints and watchpoints belong to the host like the mapping and are not saved. Region flags keep the cost of both to pages that have them.
+	Track flags pages, e.g. VRAM and ARAM, whose bit changes are stamped with Clock and queued in Changes for the host to Drain,
+	or passed to OnChange as they happen. the core sets Clock before every str, a host writing tracked pages itself sets it first.
+	LoadState and Patch replace memory wholesale and report nothing.
+	*/
+	uint64_t Bits[0x400];	//backing store, bit n of Bits[a >> 6] is address a with n = a & 63
+	Region Pages[0x100];	//page table, indexed by address >> 8
+	uint32_t CodeVersion = 0;	//incremented whenever translated code may have changed
+	uint32_t DeviceReads = 0;	//reads that reached a Device, which may have side effects
+	OpcodeTable Opcodes;	//6-bit opcode starting at every ROM bit address 0x0000-0x7ffa
+	vector<uint64_t> Breakpoints;	//by fetch address, same layout as Bits. empty until the first is set, as only pages flagged breakpoint look here
+	vector<uint64_t> Watchpoints;	//by index into Bits, so every mirror of a watched bit is watched. empty likewise, for pages flagged watch
+	uint64_t Clock = 0;	//tick stamped on tracked changes
+	vector<MemoryChange> Changes;	//tracked changes not drained yet, oldest first
+	function<void(const MemoryChange&)> OnChange;	//if set, gets every tracked change instead of Changes
+	int32_t WatchHit = -1;	//address of the last write reaching a watched bit, -1 for none. BBBBrainDumbed::Execute clears it and stops on it
+
+	Memory() {
+		for (size_t i = 0; i < 0x400; i++)
+		{
+			Bits[i] = ~writable()[i];	//reserved bits read as 1
+		}
+		MapFlat(0xc000, 0xdfff, 0xc01f);
+		MapFlat(0xe000, 0xefff, 0xe007);
+		MapFlat(0xf000, 0xf7ff, 0xf00f);
+	}
+
+	void Load(shared_ptr<const Rom> rom) {	//replaces all of ROM: copies rom's bits, which str may change, and shares its predecoded opcodes until then
+		for (size_t i = 0; i < 0x200; i++)
+		{
+			Bits[i] = rom->Bits[i];
+		}
+		Opcodes.Share(rom);
+		CodeVersion++;
+	}
+
+	void SaveState(StateWriter& out) const {	//ROM by hash plus words changed since loading, every other word against a new Memory. mapping is configuration and is not saved
+		const Rom& rom = *Opcodes.Image();
+		out.Put(rom.Hash, 8);
+		putWords(out, 0, 0x200, rom.Bits);
+		putWords(out, 0x200, 0x400, blank().Bits);
+	}
+
+	void LoadState(StateReader& in, shared_ptr<const Rom> rom) {	//rom must hash as saved, nullptr keeps the image loaded now
+		if (rom == nullptr)
+		{
+			rom = Opcodes.Image();
+		}
+		if (in.Get(8) != rom->Hash)
+		{
+			throw invalid_argument("State was saved with a different ROM.");
+		}
+		uint64_t words[0x400];
+		bool patched = getWords(in, 0, 0x200, rom->Bits, words);
+		getWords(in, 0x200, 0x400, blank().Bits, words);
+		if (rom != Opcodes.Image() || !Opcodes.IsShared() || patched)	//same unmodified image keeps ROM, predecoded opcodes and translations
+		{
+			Load(rom);
+			for (size_t i = 0; i < 0x200; i++)
+			{
+				Bits[i] = words[i];
+			}
+			if (patched)
+			{
+				DecodeRom(0, 0x8000 - 6);
+			}
+		}
+		bool code = false;
+		for (size_t i = 0x200; i < 0x400; i++)
+		{
+			if (Bits[i] != words[i])
+			{
+				Bits[i] = words[i];
+				code = code || Pages[i >> 2].code;
+			}
+		}
+		if (code)
+		{
+			CodeVersion++;
+		}
+	}
+
+	void Patch(size_t index, uint64_t word) {	//sets Bits[index] as restoring a snapshot does, keeping translations and predecoded ROM coherent
+		if (Bits[index] == word)
+		{
+			return;
+		}
+		Bits[index] = word;
+		if (Pages[index >> 2].code)
+		{
+			CodeVersion++;
+		}
+		if (index < 0x200)
+		{
+			DecodeRom(index * 64 < 5 ? 0 : (uint16_t)(index * 64 - 5), (uint16_t)min(index * 64 + 63, (size_t)0x8000 - 6));
+		}
+	}
+
+	void BakeRom(vector<bool> input) {
+		if (input.size() > 0x8000)
+		{
+			throw out_of_range("Input is too large.");
+		}
+		for (size_t i = 0; i < input.size(); i++)
+		{
+			if (input[i])
+			{
+				Bits[i >> 6] |= 1ull << (i & 63);
+			}
+			else
+			{
+				Bits[i >> 6] &= ~(1ull << (i & 63));
+			}
+		}
+		DecodeRom(0, 0x8000 - 6);
+		CodeVersion++;
+	}
+
+	void DecodeRom(uint16_t first, uint16_t last) {	//rebuild Opcodes[first..last]
+		uint8_t* opcodes = Opcodes.Writable();
+		for (uint32_t i = first; i <= last; i++)
+		{
+			opcodes[i] = (uint8_t)read((uint16_t)i, 6);
+		}
+	}
+
+	uint8_t fetch(uint16_t address) {
+		if (address <= 0x8000 - 6)
+		{
+			return Opcodes.Data[address];
+		}
+		return read6(address);
+	}
+
+	void Map(uint16_t first, uint16_t last, Device* device) {	//first and last must be page aligned (0x..00 and 0x..ff). nullptr restores plain storage
+		checkRange(first, last);
+		for (uint32_t i = first >> 8; i <= (uint32_t)(last >> 8); i++)
+		{
+			Pages[i].mask = 0xffff;
+			Pages[i].device = device;
+		}
+		rewatch();
+		CodeVersion++;
+	}
+
+	void MapFlat(uint16_t first, uint16_t last, uint16_t mask) {	//storage window whose addresses are masked with mask
+		checkRange(first, last);
+		for (uint32_t i = first >> 8; i <= (uint32_t)(last >> 8); i++)
+		{
+			Pages[i].mask = mask;
+			Pages[i].device = nullptr;
+		}
+		rewatch();
+		CodeVersion++;
+	}
+
+	void MarkCode(uint16_t first, uint16_t last) {
+		for (uint32_t i = first >> 8; i <= (uint32_t)(last >> 8); i++)
+		{
+			Pages[i].code = true;
+		}
+	}
+
+	void ClearCode() {
+		for (size_t i = 0; i < 0x100; i++)
+		{
+			Pages[i].code = false;
+		}
+	}
+
+	void SetBreakpoint(uint16_t address, bool set = true) {	//Execute stops before fetching from address
+		if (Breakpoints.empty())
+		{
+			if (!set)
+			{
+				return;
+			}
+			Breakpoints.assign(0x400, 0);
+		}
+		uint64_t bit = 1ull << (address & 63);
+		if (((Breakpoints[address >> 6] & bit) != 0) != set)
+		{
+			Breakpoints[address >> 6] ^= bit;
+			set ? breakpoints++ : breakpoints--;
+		}
+		size_t page = address >> 8;
+		Pages[page].breakpoint = (Breakpoints[page * 4] | Breakpoints[page * 4 + 1] | Breakpoints[page * 4 + 2] | Breakpoints[page * 4 + 3]) != 0;
+	}
+
+	void SetWatchpoint(uint16_t address, bool set = true) {	//Execute stops after a str writes the storage bit at address, through any mirror, whether or not it changes
+		if (Pages[address >> 8].device != nullptr)
+		{
+			throw invalid_argument("Device pages cannot be watched.");
+		}
+		if (Watchpoints.empty())
+		{
+			if (!set)
+			{
+				return;
+			}
+			Watchpoints.assign(0x400, 0);
+		}
+		uint16_t i = MapAddress(address);
+		uint64_t bit = 1ull << (i & 63);
+		if (((Watchpoints[i >> 6] & bit) != 0) != set)
+		{
+			Watchpoints[i >> 6] ^= bit;
+			set ? watchpoints++ : watchpoints--;
+			rewatch();
+		}
+	}
+
+	void ClearBreakpoints() {
+		Breakpoints.clear();
+		Breakpoints.shrink_to_fit();
+		for (size_t i = 0; i < 0x100; i++)
+		{
+			Pages[i].breakpoint = false;
+		}
+		breakpoints = 0;
+	}
+
+	void ClearWatchpoints() {
+		Watchpoints.clear();
+		Watchpoints.shrink_to_fit();
+		watchpoints = 0;
+		rewatch();
+	}
+
+	void Track(uint16_t first, uint16_t last, bool set = true) {	//first and last must be page aligned (0x..00 and 0x..ff)
+		checkRange(first, last);
+		for (uint32_t i = first >> 8; i <= (uint32_t)(last >> 8); i++)
+		{
+			Pages[i].tracked = set;
+		}
+		tracking = false;
+		for (size_t i = 0; i < 0x100; i++)
+		{
+			tracking = tracking || Pages[i].tracked;
+		}
+	}
+
+	vector<MemoryChange> Drain() {	//tracked changes since the last Drain, oldest first
+		vector<MemoryChange> changes;
+		changes.swap(Changes);
+		return changes;
+	}
+
+	bool Tracking() const {	//any page tracked
+		return tracking;
+	}
+
+	bool IsBreakpoint(uint16_t address) const {
+		return Pages[address >> 8].breakpoint && (Breakpoints[address >> 6] >> (address & 63)) & 1;
+	}
+
+	bool Debugging() const {	//any breakpoint or watchpoint set
+		return breakpoints != 0 || watchpoints != 0;
+	}
+
+	uint16_t MapAddress(uint16_t input) {
+		return input & Pages[input >> 8].mask;
+	}
+
+	bool read(uint16_t address) {
+		const Region& page = Pages[address >> 8];
+		if (page.device != nullptr)
+		{
+			DeviceReads++;
+			return page.device->read(address);
+		}
+		uint16_t i = address & page.mask;
+		return (Bits[i >> 6] >> (i & 63)) & 1;
+	}
+
+	uint64_t read(uint16_t address, uint8_t width) {	//width bits starting at address, LSB first. width <= 64
+		if (isFlat(address, width))
+		{
+			uint64_t out = Bits[address >> 6] >> (address & 63);
+			if ((address & 63) + width > 64)
+			{
+				out |= Bits[(address >> 6) + 1] << (64 - (address & 63));
+			}
+			return out & widthMask(width);
+		}
+		uint64_t out = 0;
+		for (uint8_t i = 0; i < width; i++)
+		{
+			out |= (uint64_t)read((uint16_t)(address + i)) << i;
+		}
+		return out;
+	}
+
+	uint8_t read6(uint16_t address) {
+		return (uint8_t)read(address, 6);
+	}
+
+	uint16_t read16(uint16_t address) {
+		return (uint16_t)read(address, 16);
+	}
+
+	void write(uint16_t address, bool value) {
+		const Region& page = Pages[address >> 8];
+		if (page.device != nullptr)
+		{
+			page.device->write(address, value);
+			return;
+		}
+		uint16_t i = address & page.mask;
+		uint64_t bit = 1ull << (i & 63);
+		if (page.watch && (Watchpoints[i >> 6] & bit))
+		{
+			WatchHit = address;
+		}
+		if (!(writable()[i >> 6] & bit) || (bool)(Bits[i >> 6] & bit) == value)
+		{
+			return;
+		}
+		Bits[i >> 6] ^= bit;
+		if (page.tracked)
+		{
+			report(i, value);
+		}
+		if (Pages[i >> 8].code)
+		{
+			CodeVersion++;
+		}
+		if (i <= 0x7fff)
+		{
+			DecodeRom(i < 5 ? 0 : i - 5, i < 0x8000 - 6 ? i : 0x8000 - 6);	//keep predecoded opcodes coherent with self-modifying code
+		}
+	}
+
+	void write(uint16_t address, uint64_t value, uint8_t width) {	//width bits starting at address, LSB first. width <= 64
+		if (!isFlat(address, width))
+		{
+			for (uint8_t i = 0; i < width; i++)
+			{
+				write((uint16_t)(address + i), (bool)((value >> i) & 1));
+			}
+			return;
+		}
+		uint64_t changed = writeWord(address >> 6, value << (address & 63), widthMask(width) << (address & 63));
+		if ((address & 63) + width > 64)
+		{
+			changed |= writeWord((address >> 6) + 1, value >> (64 - (address & 63)), widthMask(width) >> (64 - (address & 63)));
+		}
+		if (changed && address <= 0x7fff)
+		{
+			uint16_t last = address + width - 1 < 0x8000 - 6 ? address + width - 1 : 0x8000 - 6;
+			DecodeRom(address < 5 ? 0 : address - 5, last);
+		}
+	}
+
+	void write(uint16_t address, vector<bool> value) {
+		for (uint8_t i = 0; i < value.size(); i++)
+		{
+			write(address + i, value[i]);
+		}
+	}
+
+	void write(uint16_t address, uint16_t value) {
+		write(address, (uint64_t)value, 16);
+	}
+
+	bool isStorage(uint16_t address, uint8_t width) {	//whole range is backed by Bits (possibly mirrored), no device, and does not wrap past 0xffff
+		return width != 0 && (uint32_t)address + width <= 0x10000 && Pages[address >> 8].device == nullptr && Pages[(address + width - 1) >> 8].device == nullptr;
+	}
+
+	bool isFlat(uint16_t address, uint8_t width) {	//whole range is plain storage and does not wrap past 0xffff
+		return width != 0 && (uint32_t)address + width <= 0x10000 && Pages[address >> 8].isFlat() && Pages[(address + width - 1) >> 8].isFlat();
+	}
+
+private:
+	size_t breakpoints = 0;	//bits set in Breakpoints
+	size_t watchpoints = 0;	//bits set in Watchpoints
+	bool tracking = false;	//any Region tracked
+
+	static const Memory& blank() {
+		static const Memory memory;
+		return memory;
+	}
+
+	void putWords(StateWriter& out, size_t first, size_t last, const uint64_t* baseline) const {	//bitmap of words differing from baseline, then those words
+		for (size_t i = first; i < last; i += 8)
+		{
+			uint8_t present = 0;
+			for (size_t j = 0; j < 8; j++)
+			{
+				present |= (uint8_t)((Bits[i + j] != baseline[i + j]) << j);
+			}
+			out.Put(present, 1);
+		}
+		for (size_t i = first; i < last; i++)
+		{
+			if (Bits[i] != baseline[i])
+			{
+				out.Put(Bits[i], 8);
+			}
+		}
+	}
+
+	static bool getWords(StateReader& in, size_t first, size_t last, const uint64_t* baseline, uint64_t* words) {	//returns whether any word differs from baseline
+		uint8_t present[0x400 / 8];
+		bool any = false;
+		for (size_t i = first; i < last; i += 8)
+		{
+			present[i / 8] = (uint8_t)in.Get(1);
+			any = any || present[i / 8] != 0;
+		}
+		for (size_t i = first; i < last; i++)
+		{
+			words[i] = (present[i / 8] >> (i & 7)) & 1 ? in.Get(8) : baseline[i];
+		}
+		return any;
+	}
+
+	void checkRange(uint16_t first, uint16_t last) {
+		if ((first & 0xff) != 0 || (last & 0xff) != 0xff || first > last)
+		{
+			throw invalid_argument("Region must cover whole pages.");
+		}
+		if (first <= 0x7fff)
+		{
+			throw out_of_range("ROM cannot be remapped.");
+		}
+	}
+
+	static const uint64_t* writable() {	//0 for reserved bits, one table for every Memory
+		static const vector<uint64_t> table = []() {
+			vector<uint64_t> table(0x400, ~0ull);
+			const uint16_t reserved[][2] = { { 0xc017, 0xdfff }, { 0xe005, 0xefff }, { 0xf005, 0xf007 }, { 0xf00d, 0xffff } };
+			for (const auto& range : reserved)
+			{
+				for (uint32_t i = range[0]; i <= range[1]; i++)
+				{
+					table[i >> 6] &= ~(1ull << (i & 63));
+				}
+			}
+			return table;
+		}();
+		return table.data();
+	}
+
+	void report(uint16_t address, bool value) {	//to OnChange or Changes
+		MemoryChange change;
+		change.Tick = Clock;
+		change.Address = address;
+		change.Value = value;
+		if (OnChange)
+		{
+			OnChange(change);
+		}
+		else
+		{
+			Changes.push_back(change);
+		}
+	}
+
+	void rewatch() {	//flags every page with an address mapped onto a watched bit
+		for (size_t page = 0; page < 0x100; page++)
+		{
+			Pages[page].watch = false;
+			for (uint32_t address = (uint32_t)page << 8; watchpoints != 0 && Pages[page].device == nullptr && !Pages[page].watch && address < (uint32_t)(page + 1) << 8; address++)
+			{
+				uint16_t i = (uint16_t)address & Pages[page].mask;
+				Pages[page].watch = (Watchpoints[i >> 6] >> (i & 63)) & 1;
+			}
+		}
+	}
+
+	static uint64_t widthMask(uint8_t width) {
+		return width >= 64 ? ~0ull : (1ull << width) - 1;
+	}
+
+	uint64_t writeWord(size_t index, uint64_t value, uint64_t mask) {	//returns changed bits
+		if (Pages[index >> 2].watch && (Watchpoints[index] & mask))	//flat, index is the address
+		{
+			uint8_t n = 0;
+			while (!((Watchpoints[index] & mask) >> n & 1))
+			{
+				n++;
+			}
+			WatchHit = (int32_t)(index * 64 + n);
+		}
+		mask &= writable()[index];
+		uint64_t changes = (Bits[index] ^ value) & mask;
+		Bits[index] ^= changes;
+		if (changes && Pages[index >> 2].code)
+		{
+			CodeVersion++;
+		}
+		for (uint8_t n = 0; changes && Pages[index >> 2].tracked && n < 64; n++)
+		{
+			if ((changes >> n) & 1)
+			{
+				report((uint16_t)(index * 64 + n), (Bits[index] >> n) & 1);
+			}
+		}
+		return changes;
+	}
+};
@@ -0,0 +1,171 @@
+#pragma once
+#include<stdint.h>
+#include<vector>
+#include<tuple>
+#include<memory>
+#include<stdexcept>
+
+#include"memory.h"
+#include"savestate.h"
+#include"scheduler.h"
+
+using namespace std;
+
+/*
+input movie: every input applied to a controller port with the tick it was applied at, from a known start, enough to replay a run exactly.
+Begin saves the machine's state and hooks Machine::OnInput, so inputs queued with PostInput are recorded as they are applied, at the machine's tick rather than the one posted for, which may have passed already,
+Finish stops at the machine's tick and keeps the hash of its state there, inputs still queued left out. every applied input is kept, as the program may have written the port since.
+the host must drive the ports through PostInput only: writes of its own, and callbacks, are not recorded.
+Replay loads the start, queues the inputs at their ticks and runs to the end in one Execute, unpaced, then compares the hash.
+file layout: "BBBM" u16 version u64 ROM hash u32 size, start state, u64 end tick u64 final hash u32 count,
+then count inputs: tick as the LEB128 difference to the previous one, u8 port << 5 | bits. little endian.
+*/
+class Movie {
+public:
+	uint64_t RomHash = 0;
+	vector<uint8_t> Start;	//SaveState when recording began
+	vector<tuple<uint64_t, uint8_t, uint8_t>> Inputs;	//tick applied at, port, bits in firing order, so the ticks never decrease
+	uint64_t End = 0;	//tick recording finished at
+	uint64_t FinalHash = 0;	//Hash of the state at End
+
+	static const uint32_t Magic = 0x4d424242;	//"BBBM"
+	static const uint16_t Version = 1;
+
+	template<class Machine> void Begin(Machine& machine) {
+		RomHash = machine.memory.Opcodes.Image()->Hash;
+		Start = machine.SaveState();
+		Inputs.clear();
+		End = machine.Tick;
+		FinalHash = state(machine);
+		machine.OnInput = [this](uint64_t tick, uint8_t port, uint8_t bits) {
+			Inputs.push_back(make_tuple(tick, port, bits));
+		};
+	}
+
+	template<class Machine> void Finish(Machine& machine) {
+		machine.OnInput = nullptr;
+		End = machine.Tick;
+		FinalHash = state(machine);
+	}
+
+	template<class Machine> bool Replay(Machine& machine, shared_ptr<const Rom> rom, uint64_t& hash) const {	//true if the run ends on FinalHash, hash is where it did end. throws invalid_argument for another ROM
+		if (rom->Hash != RomHash)
+		{
+			throw invalid_argument("Movie was recorded with a different ROM.");
+		}
+		machine.LoadState(Start, rom);
+		machine.events.Drop(EventType::Input);	//queued at Begin, recorded once applied
+		for (size_t i = 0; i < Inputs.size(); i++)
+		{
+			machine.PostInput(get<0>(Inputs[i]), get<1>(Inputs[i]), get<2>(Inputs[i]));
+		}
+		while (machine.Tick < End)
+		{
+			machine.Execute((size_t)(End - machine.Tick));
+		}
+		hash = state(machine);
+		return hash == FinalHash;
+	}
+
+	vector<uint8_t> Save() const {
+		StateWriter out;
+		out.Put(Magic, 4);
+		out.Put(Version, 2);
+		out.Put(RomHash, 8);
+		out.Put(Start.size(), 4);
+		out.Data.insert(out.Data.end(), Start.begin(), Start.end());
+		out.Put(End, 8);
+		out.Put(FinalHash, 8);
+		out.Put(Inputs.size(), 4);
+		uint64_t tick = 0;
+		for (size_t i = 0; i < Inputs.size(); i++)
+		{
+			uint64_t delta = get<0>(Inputs[i]) - tick;
+			tick = get<0>(Inputs[i]);
+			while (delta >= 0x80)
+			{
+				out.Put((delta & 0x7f) | 0x80, 1);
+				delta >>= 7;
+			}
+			out.Put(delta, 1);
+			out.Put(get<1>(Inputs[i]) << 5 | get<2>(Inputs[i]), 1);
+		}
+		return out.Data;
+	}
+
+	static Movie Load(const vector<uint8_t>& data) {	//throws invalid_argument or out_of_range on a malformed movie
+		StateReader in(data);
+		if (in.Get(4) != Magic)
+		{
+			throw invalid_argument("Not a movie.");
+		}
+		if (in.Get(2) != Version)
+		{
+			throw invalid_argument("Unsupported movie version.");
+		}
+		Movie movie;
+		movie.RomHash = in.Get(8);
+		uint64_t size = in.Get(4);
+		if (size > in.Remaining())
+		{
+			throw out_of_range("Movie is truncated.");
+		}
+		movie.Start.resize((size_t)size);
+		for (size_t i = 0; i < movie.Start.size(); i++)
+		{
+			movie.Start[i] = (uint8_t)in.Get(1);
+		}
+		movie.End = in.Get(8);
+		movie.FinalHash = in.Get(8);
+		uint64_t count = in.Get(4);
+		if (count > in.Remaining() / 2)
+		{
+			throw out_of_range("Movie is truncated.");
+		}
+		uint64_t tick = 0;
+		for (uint64_t i = 0; i < count; i++)
+		{
+			uint64_t delta = 0;
+			for (size_t shift = 0; ; shift += 7)
+			{
+				uint8_t byte = (uint8_t)in.Get(1);
+				if (shift > 63)
+				{
+					throw invalid_argument("Movie tick is too large.");
+				}
+				delta |= (uint64_t)(byte & 0x7f) << shift;
+				if (!(byte & 0x80))
+				{
+					break;
+				}
+			}
+			tick += delta;
+			uint8_t input = (uint8_t)in.Get(1);
+			movie.Inputs.push_back(make_tuple(tick, (uint8_t)((input >> 5) & 1), (uint8_t)(input & 0x1f)));
+		}
+		if (!in.AtEnd())
+		{
+			throw invalid_argument("Movie has trailing data.");
+		}
+		return movie;
+	}
+
+	static uint64_t Hash(const vector<uint8_t>& state) {	//FNV-1a over the bytes of a save state
+		uint64_t hash = 0xcbf29ce484222325ull;
+		for (size_t i = 0; i < state.size(); i++)
+		{
+			hash = (hash ^ state[i]) * 0x100000001b3ull;
+		}
+		return hash;
+	}
+
+private:
+	template<class Machine> static uint64_t state(const Machine& machine) {	//Hash of the machine's save state without the inputs still queued, which belong to after End
+		CoreState core = machine.Core();
+		core.Inputs.clear();
+		StateWriter out;
+		core.Put(out);
+		machine.memory.SaveState(out);
+		return Hash(out.Data);
+	}
+};
@@ -0,0 +1,147 @@
+#pragma once
+#include<stdint.h>
+
+#include"blockcache.h"
+
+using namespace std;
+
+/*
+compile-time policies of the execution core. BBBBrainDumbed::Execute instantiates advance once per combination
+and picks one per run between events, so a disabled feature is compiled out of the loop instead of tested in it.
+	trace: TraceOff, TraceHook calling OnInstruction after every instruction with the tick it was fetched at, its address and opcode,
+	which keeps the core in the interpreter, or TraceRing logging to the TraceBuffer in Recorder every replayed block or loop whole
+	and every interpreted instruction, see trace.h.
+	IRQ model: IrqNone while the line is low, as it cannot rise between events, otherwise IrqLine checking after every instruction.
+	granularity: InstructionGranular, whole instructions and translated blocks where they fit, or StageAccurate, every stage through Step.
+	stops: BreakNone, or BreakCheck while Memory has breakpoints or watchpoints, testing the page flag before every fetch
+	and Memory::WatchHit after every str, and leaving translated blocks to the interpreter, as a block cannot stop halfway.
+*/
+class TraceOff {
+public:
+	static const bool Enabled = false;
+	static const bool Blocks = true;	//runs translated blocks
+
+	template<class Machine> static void Record(Machine&, uint64_t, uint16_t, uint8_t) {
+
+	}
+
+	template<class Machine> static void Enter(Machine&, uint64_t) {
+
+	}
+
+	template<class Machine> static void Read(Machine&) {
+
+	}
+
+	template<class Machine> static void Replayed(Machine&, Block&, uint32_t) {
+
+	}
+
+	template<class Machine> static void Looped(Machine&, Block&, Block&, uint64_t, uint16_t) {
+
+	}
+
+	template<class Machine> static void Repeated(Machine&, uint64_t) {
+
+	}
+
+	template<class Machine> static void Taken(Machine&) {
+
+	}
+
+	template<class Machine> static void Resync(Machine&) {
+
+	}
+
+	template<class Machine> static void Flush(Machine&) {
+
+	}
+};
+
+class TraceHook : public TraceOff {	//interprets, OnInstruction wants every instruction as it runs
+public:
+	static const bool Enabled = true;
+	static const bool Blocks = false;
+
+	template<class Machine> static void Record(Machine& machine, uint64_t tick, uint16_t address, uint8_t opcode) {
+		machine.OnInstruction(tick, address, opcode);
+	}
+};
+
+class TraceRing {	//blocks recorded whole, see TraceBuffer
+public:
+	static const bool Enabled = true;
+	static const bool Blocks = true;
+
+	template<class Machine> static void Record(Machine& machine, uint64_t tick, uint16_t address, uint8_t opcode) {
+		machine.Recorder->Record(machine, tick, address, opcode);
+	}
+
+	template<class Machine> static void Enter(Machine& machine, uint64_t tick) {
+		machine.Recorder->Enter(machine, tick);
+	}
+
+	template<class Machine> static void Read(Machine& machine) {
+		machine.Recorder->Read(machine);
+	}
+
+	template<class Machine> static void Replayed(Machine& machine, Block& block, uint32_t count) {
+		machine.Recorder->Replayed(block, count);
+	}
+
+	template<class Machine> static void Looped(Machine& machine, Block& head, Block& tail, uint64_t count, uint16_t bits) {
+		machine.Recorder->Looped(head, tail, count, bits);
+	}
+
+	template<class Machine> static void Repeated(Machine& machine, uint64_t laps) {
+		machine.Recorder->Repeated(laps);
+	}
+
+	template<class Machine> static void Taken(Machine& machine) {
+		machine.Recorder->Taken();
+	}
+
+	template<class Machine> static void Resync(Machine& machine) {
+		machine.Recorder->Resync();
+	}
+
+	template<class Machine> static void Flush(Machine& machine) {
+		machine.Recorder->Flush();
+	}
+};
+
+class IrqNone {
+public:
+	static const bool Enabled = false;
+};
+
+class IrqLine {
+public:
+	static const bool Enabled = true;
+};
+
+class BreakNone {
+public:
+	static const bool Enabled = false;
+};
+
+class BreakCheck {
+public:
+	static const bool Enabled = true;
+};
+
+enum class StopReason {	//why BBBBrainDumbed::Execute returned
+	None,	//ran its count
+	Breakpoint,	//about to fetch from a breakpoint
+	Watchpoint,	//a str just wrote a watched bit
+};
+
+class InstructionGranular {
+public:
+	static const bool Stepped = false;
+};
+
+class StageAccurate {
+public:
+	static const bool Stepped = true;
+};
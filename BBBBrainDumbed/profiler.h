@@ -0,0 +1,144 @@
+#pragma once
+#include<stdint.h>
+#include<string>
+#include<vector>
+#include<map>
+#include<sstream>
+#include<iostream>
+#include<iomanip>
+#include<algorithm>
+
+using namespace std;
+
+/*
+opt-in execution profiler. Execute runs the machine stage by stage instead of through its engine, so nothing is paid
+when it is not used, and charges every instruction and every tick to the bit address it was fetched from,
+the extra stages of ldr and str included.
+HotLines and Listing map addresses back to source through the Machine::DebugMap filled in by Parser,
+addresses without an entry, e.g. code in RAM, are reported by address.
+*/
+template<class Machine> class Profiler {
+public:
+	vector<uint64_t> Instructions = vector<uint64_t>(0x10000);	//by bit address
+	vector<uint64_t> Ticks = vector<uint64_t>(0x10000);
+
+	void Execute(Machine& machine, size_t count) {	//machine.Execute(count), profiled
+		uint64_t target = machine.Tick + count;
+		while (machine.Tick < target)
+		{
+			if (machine.stage == 1)	//the next stage fetches at P
+			{
+				current = machine.P;
+				Instructions[current]++;
+			}
+			uint64_t before = machine.Tick;
+			machine.Execute(1);
+			Ticks[current] += machine.Tick - before;
+		}
+	}
+
+	void Clear() {
+		fill(Instructions.begin(), Instructions.end(), 0);
+		fill(Ticks.begin(), Ticks.end(), 0);
+	}
+
+	void HotLines(const typename Machine::DebugMap& debug, wostream& out, size_t top = 20) const {	//source lines by ticks spent, hottest first
+		vector<Line> lines = collect(debug);
+		sort(lines.begin(), lines.end(), [](const Line& a, const Line& b) { return a.ticks > b.ticks; });
+		uint64_t total = max(sum(Ticks), (uint64_t)1);
+		out << L"      ticks      %   instructions  source" << endl;
+		for (size_t i = 0; i < lines.size() && i < top; i++)
+		{
+			out << setw(11) << lines[i].ticks << L"  " << fixed << setprecision(2) << setw(5) << lines[i].ticks * 100.0 / total << L"  " << setw(13) << lines[i].instructions << L"  " << lines[i].name << endl;
+		}
+		out.unsetf(ios_base::floatfield);
+	}
+
+	void Listing(const typename Machine::DebugMap& debug, const wstring& filename, const wstring& source, wostream& out) const {	//source of filename with ticks, share and instructions per line
+		map<size_t, Line> byLine;
+		vector<Line> lines = collect(debug);
+		for (size_t i = 0; i < lines.size(); i++)
+		{
+			if (lines[i].filename == filename)
+			{
+				byLine[lines[i].line] = lines[i];
+			}
+		}
+		uint64_t total = max(sum(Ticks), (uint64_t)1);
+		wistringstream in(source);
+		wstring text;
+		for (size_t n = 1; getline(in, text); n++)
+		{
+			if (!text.empty() && text.back() == L'\r')
+			{
+				text.pop_back();
+			}
+			typename map<size_t, Line>::const_iterator found = byLine.find(n);
+			if (found == byLine.end() || found->second.ticks == 0)
+			{
+				out << setw(11) << L"" << L"  " << setw(5) << L"" << L"  " << setw(13) << L"";
+			}
+			else
+			{
+				out << setw(11) << found->second.ticks << L"  " << fixed << setprecision(2) << setw(5) << found->second.ticks * 100.0 / total << L"  " << setw(13) << found->second.instructions;
+			}
+			out << L"  " << setw(5) << n << L"  " << text << endl;
+		}
+		out.unsetf(ios_base::floatfield);
+	}
+
+private:
+	uint16_t current = 0;	//address of the instruction in flight
+
+	class Line {
+	public:
+		wstring name;	//filename:line, or the address for code without source
+		wstring filename;
+		size_t line = 0;
+		uint64_t ticks = 0;
+		uint64_t instructions = 0;
+	};
+
+	static uint64_t sum(const vector<uint64_t>& counts) {
+		uint64_t total = 0;
+		for (size_t i = 0; i < counts.size(); i++)
+		{
+			total += counts[i];
+		}
+		return total;
+	}
+
+	vector<Line> collect(const typename Machine::DebugMap& debug) const {	//counts summed per source line
+		map<wstring, Line> lines;
+		for (size_t i = 0; i < 0x10000; i++)
+		{
+			if (Ticks[i] == 0 && Instructions[i] == 0)
+			{
+				continue;
+			}
+			typename Machine::DebugMap::const_iterator found = debug.find((uint16_t)i);
+			Line key;
+			if (found == debug.end())
+			{
+				wostringstream name;
+				name << L"0x" << hex << setw(4) << setfill(L'0') << i;
+				key.name = name.str();
+			}
+			else
+			{
+				key.filename = found->second.filename;
+				key.line = found->second.line;
+				key.name = key.filename + L":" + to_wstring(key.line);
+			}
+			Line& line = lines.insert(make_pair(key.name, key)).first->second;
+			line.ticks += Ticks[i];
+			line.instructions += Instructions[i];
+		}
+		vector<Line> result;
+		for (typename map<wstring, Line>::const_iterator i = lines.begin(); i != lines.end(); i++)
+		{
+			result.push_back(i->second);
+		}
+		return result;
+	}
+};
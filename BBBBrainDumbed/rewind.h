@@ -0,0 +1,176 @@
+#pragma once
+#include<stdint.h>
+#include<vector>
+#include<utility>
+#include<stdexcept>
+#include<algorithm>
+
+#include"savestate.h"
+
+using namespace std;
+
+class Snapshot {
+public:
+	CoreState core;
+	vector<uint64_t> image;	//every Memory::Bits word, keyframes only
+	vector<pair<uint16_t, uint64_t>> changes;	//Memory::Bits words changed since the previous snapshot, otherwise
+
+	bool IsKeyframe() const {
+		return !image.empty();
+	}
+};
+
+/*
+keeps the last Capacity snapshots of a machine, taken every Interval ticks by Execute, in a fixed ring.
+a snapshot stores the machine's CoreState and only the memory words changed since the snapshot before it,
+every KeyframeInterval-th one stores all of memory. the oldest snapshot is always a keyframe:
+when it is overwritten the next one is promoted by applying its changes to the old image.
+RewindTo restores the nearest snapshot at or before a tick and executes forward to it.
+the memory map, devices and callback events belong to the host and are not rewound.
+*/
+template<class Machine> class Rewind {
+public:
+	uint64_t Interval;	//ticks between snapshots
+	size_t KeyframeInterval;	//snapshots per keyframe
+
+	explicit Rewind(size_t capacity = 256, uint64_t interval = 100000, size_t keyframeInterval = 32) : Interval(interval), KeyframeInterval(keyframeInterval), ring(max(capacity, (size_t)1)) {
+
+	}
+
+	void Execute(Machine& machine, size_t count) {	//machine.Execute(count), capturing a snapshot every Interval ticks
+		uint64_t target = machine.Tick + count;
+		if (used == 0)
+		{
+			Capture(machine);
+		}
+		while (machine.Tick < target)
+		{
+			uint64_t next = back().core.Tick + Interval;
+			machine.Execute((size_t)(min(target, max(next, machine.Tick + 1)) - machine.Tick));
+			if (machine.Tick >= next)
+			{
+				Capture(machine);
+			}
+		}
+	}
+
+	void Capture(const Machine& machine) {
+		if (used == ring.size())	//drop the oldest, it is a keyframe
+		{
+			Snapshot& oldest = ring[first];
+			first = (first + 1) % ring.size();
+			used--;
+			if (used != 0 && !ring[first].IsKeyframe())
+			{
+				Snapshot& promoted = ring[first];
+				promoted.image.swap(oldest.image);
+				for (size_t i = 0; i < promoted.changes.size(); i++)
+				{
+					promoted.image[promoted.changes[i].first] = promoted.changes[i].second;
+				}
+				promoted.changes.clear();
+			}
+		}
+		Snapshot& snapshot = ring[(first + used) % ring.size()];
+		used++;
+		snapshot.core = machine.Core();
+		const uint64_t* bits = machine.memory.Bits;
+		snapshot.changes.clear();
+		if (sinceKeyframe + 1 >= KeyframeInterval || used == 1)
+		{
+			snapshot.image.assign(bits, bits + 0x400);
+			sinceKeyframe = 0;
+		}
+		else
+		{
+			snapshot.image.clear();
+			for (size_t i = 0; i < 0x400; i++)
+			{
+				if (bits[i] != last[i])
+				{
+					snapshot.changes.push_back(make_pair((uint16_t)i, bits[i]));
+				}
+			}
+			sinceKeyframe++;
+		}
+		copy(bits, bits + 0x400, last);
+	}
+
+	void RewindTo(Machine& machine, uint64_t tick) {	//snapshots after the one restored are discarded, throws if tick is older than every snapshot
+		size_t n = used;
+		while (n != 0 && at(n - 1).core.Tick > tick)
+		{
+			n--;
+		}
+		if (n == 0)
+		{
+			throw out_of_range("Tick is older than every snapshot.");
+		}
+		size_t key = n - 1;
+		while (!at(key).IsKeyframe())
+		{
+			key--;
+		}
+		copy(at(key).image.begin(), at(key).image.end(), last);
+		for (size_t i = key + 1; i < n; i++)
+		{
+			const vector<pair<uint16_t, uint64_t>>& changes = at(i).changes;
+			for (size_t j = 0; j < changes.size(); j++)
+			{
+				last[changes[j].first] = changes[j].second;
+			}
+		}
+		for (size_t i = 0; i < 0x400; i++)
+		{
+			machine.memory.Patch(i, last[i]);
+		}
+		machine.Restore(at(n - 1).core);
+		used = n;
+		sinceKeyframe = n - 1 - key;
+		if (tick > machine.Tick)
+		{
+			machine.Execute((size_t)(tick - machine.Tick));
+		}
+	}
+
+	uint64_t Oldest() const {	//earliest tick RewindTo can reach, UINT64_MAX if nothing was captured
+		return used == 0 ? UINT64_MAX : ring[first].core.Tick;
+	}
+
+	size_t Size() const {	//snapshots held
+		return used;
+	}
+
+	size_t Bytes() const {	//memory held by snapshots beyond the ring itself
+		size_t bytes = 0;
+		for (size_t i = 0; i < used; i++)
+		{
+			bytes += at(i).image.size() * sizeof(uint64_t) + at(i).changes.size() * sizeof(pair<uint16_t, uint64_t>) + at(i).core.Levels.size() * sizeof(pair<uint64_t, bool>) + at(i).core.Inputs.size() * sizeof(tuple<uint64_t, uint8_t, uint8_t>);
+		}
+		return bytes;
+	}
+
+	void Clear() {
+		used = 0;
+		sinceKeyframe = 0;
+	}
+
+private:
+	vector<Snapshot> ring;
+	size_t first = 0;	//oldest snapshot
+	size_t used = 0;
+	size_t sinceKeyframe = 0;	//deltas captured since the newest keyframe
+	uint64_t last[0x400];	//memory as of the newest snapshot
+
+	Snapshot& at(size_t n) {	//n-th oldest
+		return ring[(first + n) % ring.size()];
+	}
+
+	const Snapshot& at(size_t n) const {
+		return ring[(first + n) % ring.size()];
+	}
+
+	Snapshot& back() {
+		return at(used - 1);
+	}
+};
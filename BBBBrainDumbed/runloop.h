@@ -0,0 +1,103 @@
+#pragma once
+#include<stdint.h>
+#include<chrono>
+#include<thread>
+#include<functional>
+#include<algorithm>
+#include<atomic>
+
+using namespace std;
+
+/*
+runs a machine frame by frame, TicksPerFrame ticks each.
+paced, frame n starts at start + n / FrameRate on the steady clock: the loop sleeps while the remaining wait is longer than
+twice the average oversleep and yields for the rest, so it neither pegs a core nor inherits the timer granularity as jitter.
+a loop more than MaxLag frames behind resynchronises instead of running a burst of frames.
+Turbo drops pacing and runs frames back to back.
+*/
+template<class Machine> class RunLoop {
+public:
+	size_t TicksPerFrame = 100000;
+	double FrameRate = 60.0;	//target frames per wall-clock second, real time is TicksPerFrame * FrameRate ticks per second
+	bool Turbo = false;
+	uint32_t MaxLag = 4;
+	function<void(Machine&, uint64_t)> OnFrame;	//called after every frame with its number, e.g. to present output
+
+	uint64_t Frames = 0;	//since the last Run
+	uint64_t Ticks = 0;
+	double Elapsed = 0;	//wall-clock seconds
+	double MaxLateness = 0;	//worst delay of a paced frame start behind its deadline, seconds
+
+	void Run(Machine& machine, uint64_t frames) {	//runs frames frames, or until Stop
+		typedef chrono::steady_clock clock;
+		Frames = 0;
+		Ticks = 0;
+		MaxLateness = 0;
+		stopped = false;
+		clock::time_point start = clock::now(), origin = start;
+		uint64_t paced = 0;	//frames since origin
+		while (Frames < frames && !stopped)
+		{
+			if (!Turbo)
+			{
+				clock::time_point deadline = origin + chrono::duration_cast<clock::duration>(chrono::duration<double>(paced / FrameRate));
+				wait(deadline);
+				double late = chrono::duration<double>(clock::now() - deadline).count();
+				if (late > MaxLag / FrameRate)	//too far behind to catch up
+				{
+					origin = clock::now();
+					paced = 0;
+				}
+				else
+				{
+					MaxLateness = max(MaxLateness, late);
+				}
+			}
+			uint64_t before = machine.Tick;
+			machine.Execute(TicksPerFrame);
+			Ticks += machine.Tick - before;
+			Frames++;
+			paced++;
+			if (OnFrame)
+			{
+				OnFrame(machine, Frames - 1);
+			}
+		}
+		Elapsed = chrono::duration<double>(clock::now() - start).count();
+	}
+
+	void Stop() {	//from OnFrame or another thread, ends Run after the current frame
+		stopped = true;
+	}
+
+	double Speed() const {	//emulated time over wall-clock time of the last Run, 1 is real time
+		return Elapsed > 0 ? Ticks / (TicksPerFrame * FrameRate) / Elapsed : 0;
+	}
+
+private:
+	atomic<bool> stopped{ false };
+	chrono::steady_clock::duration oversleep = chrono::milliseconds(1);	//running average of sleep_for overshoot
+
+	void wait(chrono::steady_clock::time_point deadline) {
+		typedef chrono::steady_clock clock;
+		while (true)
+		{
+			clock::time_point now = clock::now();
+			if (now >= deadline)
+			{
+				return;
+			}
+			if (deadline - now > oversleep * 2)
+			{
+				clock::duration request = deadline - now - oversleep * 2;
+				this_thread::sleep_for(request);
+				clock::duration over = clock::now() - now - request;
+				oversleep = (oversleep * 7 + max(over, clock::duration::zero())) / 8;
+			}
+			else
+			{
+				this_thread::yield();
+			}
+		}
+	}
+};
@@ -0,0 +1,156 @@
+#pragma once
+#include<stdint.h>
+#include<vector>
+#include<stdexcept>
+#include<utility>
+#include<tuple>
+
+using namespace std;
+
+/*
+byte buffers for BBBBrainDumbed::SaveState and LoadState. fields are little endian and sized by the caller.
+blob layout, version 3:
+	"BBBS" u16 version
+	Z X Y A B D E P V T: u16 each, I J inst stage: u8 each, C | M << 1 | IRQ << 2: u8, Tick: u64, Instructions: u64, absent before version 3 and read as 0
+	u32 count, then count queued IRQ events in firing order: u64 tick, u8 level
+	u32 count, then count queued controller inputs in firing order: u64 tick, u8 port, u8 bits. absent in version 1
+	u64 hash of the ROM image, then ROM words changed since the image was loaded, then RAM and the rest as words differing from a new Memory.
+	each word set is a bitmap of present words followed by the present words.
+*/
+class StateWriter {
+public:
+	vector<uint8_t> Data;
+
+	void Put(uint64_t value, size_t bytes) {
+		for (size_t i = 0; i < bytes; i++)
+		{
+			Data.push_back((uint8_t)(value >> (i * 8)));
+		}
+	}
+};
+
+class StateReader {
+public:
+	StateReader(const vector<uint8_t>& data) : data(data) {
+
+	}
+
+	uint64_t Get(size_t bytes) {
+		if (position + bytes > data.size())
+		{
+			throw out_of_range("State is truncated.");
+		}
+		uint64_t value = 0;
+		for (size_t i = 0; i < bytes; i++)
+		{
+			value |= (uint64_t)data[position++] << (i * 8);
+		}
+		return value;
+	}
+
+	bool AtEnd() const {
+		return position == data.size();
+	}
+
+	size_t Remaining() const {
+		return data.size() - position;
+	}
+
+private:
+	const vector<uint8_t>& data;
+	size_t position = 0;
+};
+
+inline uint64_t StateHash(const uint64_t* words, size_t count) {	//FNV-1a over the bytes of words
+	uint64_t hash = 0xcbf29ce484222325ull;
+	for (size_t i = 0; i < count; i++)
+	{
+		for (size_t j = 0; j < 64; j += 8)
+		{
+			hash = (hash ^ ((words[i] >> j) & 0xff)) * 0x100000001b3ull;
+		}
+	}
+	return hash;
+}
+
+class CoreState {	//machine state besides memory, as SaveState stores it
+public:
+	uint16_t Z = 0, X = 0, Y = 0, A = 0, B = 0, D = 0, E = 0, P = 0, V = 0, T = 0;
+	uint8_t I = 0, J = 0, inst = 0, stage = 0;
+	bool C = false, M = false, IRQ = false;
+	uint64_t Tick = 0;
+	uint64_t Instructions = 0;
+	vector<pair<uint64_t, bool>> Levels;	//queued IRQ events in firing order: tick, level
+	vector<tuple<uint64_t, uint8_t, uint8_t>> Inputs;	//queued controller inputs in firing order: tick, port, bits
+
+	void Put(StateWriter& out) const {
+		const uint16_t words[] = { Z, X, Y, A, B, D, E, P, V, T };
+		for (size_t i = 0; i < 10; i++)
+		{
+			out.Put(words[i], 2);
+		}
+		out.Put(I, 1);
+		out.Put(J, 1);
+		out.Put(inst, 1);
+		out.Put(stage, 1);
+		out.Put(C | M << 1 | IRQ << 2, 1);
+		out.Put(Tick, 8);
+		out.Put(Instructions, 8);
+		out.Put(Levels.size(), 4);
+		for (size_t i = 0; i < Levels.size(); i++)
+		{
+			out.Put(Levels[i].first, 8);
+			out.Put(Levels[i].second, 1);
+		}
+		out.Put(Inputs.size(), 4);
+		for (size_t i = 0; i < Inputs.size(); i++)
+		{
+			out.Put(get<0>(Inputs[i]), 8);
+			out.Put(get<1>(Inputs[i]), 1);
+			out.Put(get<2>(Inputs[i]), 1);
+		}
+	}
+
+	static CoreState Get(StateReader& in, uint16_t version) {
+		CoreState core;
+		uint16_t* words[] = { &core.Z, &core.X, &core.Y, &core.A, &core.B, &core.D, &core.E, &core.P, &core.V, &core.T };
+		for (size_t i = 0; i < 10; i++)
+		{
+			*words[i] = (uint16_t)in.Get(2);
+		}
+		core.I = (uint8_t)in.Get(1);
+		core.J = (uint8_t)in.Get(1);
+		core.inst = (uint8_t)in.Get(1);
+		core.stage = (uint8_t)in.Get(1);
+		uint8_t flags = (uint8_t)in.Get(1);
+		core.C = (flags & 1) != 0;
+		core.M = (flags & 2) != 0;
+		core.IRQ = (flags & 4) != 0;
+		core.Tick = in.Get(8);
+		core.Instructions = version >= 3 ? in.Get(8) : 0;
+		uint64_t count = in.Get(4);
+		if (count > in.Remaining() / 9)
+		{
+			throw out_of_range("State is truncated.");
+		}
+		core.Levels.resize((size_t)count);
+		for (size_t i = 0; i < core.Levels.size(); i++)
+		{
+			core.Levels[i].first = in.Get(8);
+			core.Levels[i].second = in.Get(1) != 0;
+		}
+		count = version >= 2 ? in.Get(4) : 0;
+		if (count > in.Remaining() / 10)
+		{
+			throw out_of_range("State is truncated.");
+		}
+		core.Inputs.resize((size_t)count);
+		for (size_t i = 0; i < core.Inputs.size(); i++)
+		{
+			uint64_t tick = in.Get(8);
+			uint8_t port = (uint8_t)in.Get(1);
+			core.Inputs[i] = make_tuple(tick, port, (uint8_t)in.Get(1));
+		}
+		return core;
+	}
+};
@@ -0,0 +1,87 @@
+#pragma once
+#include<stdint.h>
+#include<vector>
+#include<algorithm>
+#include<functional>
+
+using namespace std;
+
+enum class EventType {
+	RaiseIRQ,
+	LowerIRQ,
+	Callback,	//runs action
+	Input,	//sets a controller port
+};
+
+class Event {
+public:
+	uint64_t tick = 0;	//machine tick the event fires at
+	EventType type = EventType::Callback;
+	function<void()> action;
+	uint64_t order = 0;	//posting order, events due at the same tick fire first in first out
+	uint8_t port = 0;	//Input: 0 for ControllerInput0, 1 for ControllerInput1
+	uint8_t bits = 0;	//Input: the port's 5 bits, bit n at its address + n
+};
+
+/*
+timestamped events posted by the host or by devices.
+Execute runs the core uninterrupted up to the next event tick, stopping at the first stage boundary at or past it,
+then fires every event that is due. an action may post further events, e.g. a periodic timer reposting itself.
+*/
+class Scheduler {
+public:
+	void Post(uint64_t tick, EventType type, function<void()> action = nullptr) {
+		Event event;
+		event.tick = tick;
+		event.type = type;
+		event.action = action;
+		Post(event);
+	}
+
+	void Post(Event event) {	//order is assigned here
+		event.order = posted++;
+		queue.push_back(event);
+		push_heap(queue.begin(), queue.end(), Later());
+	}
+
+	uint64_t Next() const {	//tick of the earliest event, UINT64_MAX if none
+		return queue.empty() ? UINT64_MAX : queue.front().tick;
+	}
+
+	Event Pop() {
+		pop_heap(queue.begin(), queue.end(), Later());
+		Event event = queue.back();
+		queue.pop_back();
+		return event;
+	}
+
+	vector<Event> Queued() const {	//every queued event in firing order
+		vector<Event> events = queue;
+		sort(events.begin(), events.end(), [](const Event& a, const Event& b) { return Later()(b, a); });
+		return events;
+	}
+
+	void Drop(EventType type) {	//removes every queued event of type
+		queue.erase(remove_if(queue.begin(), queue.end(), [type](const Event& event) { return event.type == type; }), queue.end());
+		make_heap(queue.begin(), queue.end(), Later());
+	}
+
+	bool Empty() const {
+		return queue.empty();
+	}
+
+	void Clear() {
+		queue.clear();
+	}
+
+private:
+	class Later {
+	public:
+		bool operator()(const Event& a, const Event& b) const {
+			return a.tick != b.tick ? a.tick > b.tick : a.order > b.order;
+		}
+	};
+
+	vector<Event> queue;	//heap ordered by Later
+	uint64_t posted = 0;
+};
@@ -0,0 +1,614 @@
+#pragma once
+#include<stdint.h>
+#include<string>
+#include<vector>
+#include<map>
+#include<memory>
+#include<atomic>
+#include<cstring>
+#include<fstream>
+#include<iostream>
+#include<iomanip>
+#include<algorithm>
+
+#include"instructions.h"
+#include"savestate.h"
+#include"blockcache.h"
+
+using namespace std;
+
+class TraceRecord {	//one executed instruction, as the core left it
+public:
+	uint64_t Tick = 0;	//fetch started
+	uint16_t P = 0;	//fetched from
+	uint8_t Code = 0;	//opcode | C << 6 | M << 7
+	uint8_t Counters = 0;	//I | J << 4
+	uint16_t Z = 0;
+	uint16_t A = 0;	//the bit ldr reads or str writes
+};
+
+/*
+instruction trace of the last Capacity instructions, filled by the TraceRing policy when BBBBrainDumbed::Recorder is set,
+otherwise the core is not traced and pays nothing. a record is a plain copy of a few registers, the decoder works out what changed:
+every mt* copies Z, so Z and the flags and counters cover every register an instruction writes but P after bzz and bcc,
+which is where the next record was fetched.
+the core does not store a record per instruction while it runs but fixed 16 byte steps in a ring of 2 per instruction of Capacity:
+one per block RunBlocks replays with where its opcodes are and the bits its ldr read, one per copy loop run as one transfer,
+per idle loop skipped, per IRQ taken and per interpreted instruction with the bit its ldr read, and the registers in two
+once per Execute and again every quarter of the ring or of the opcodes copied. opcodes of blocks go to a ring of their own once,
+and again when half of it has been written since.
+Records rebuilds the records by rerunning the steps on a scratch machine of the type that recorded them, from the oldest registers still held,
+dropping what came before a block whose opcodes were overwritten.
+one producer, the executing thread, and lock-free readers: steps and opcodes are relaxed atomics and the count of steps is published after each,
+so Records may run on another thread while the machine runs. it copies both rings, then leaves out what may have been overwritten meanwhile.
+Dump writes the records to a file, by the host when the run ends or by the core itself the first time Trigger is executed.
+file layout: "BBBT" u16 version u32 count, then count records oldest first: u64 Tick u16 P u8 Code u8 Counters u16 Z u16 A, little endian.
+Decode renders a dump as text with the mnemonics of the assembler's instructions table.
+*/
+class TraceBuffer {
+public:
+	int32_t Trigger = -1;	//address whose execution dumps the trace to File, -1 for none
+	bool Triggered = false;
+	uint64_t TriggerTick = 0;
+	string File;
+
+	static const uint32_t Magic = 0x54424242;	//"BBBT"
+	static const uint16_t Version = 1;
+	static const size_t MinimumCapacity = 64;
+
+	explicit TraceBuffer(size_t capacity = 1 << 20) {	//rounded up to a power of 2, throws invalid_argument below MinimumCapacity
+		if (capacity < MinimumCapacity)
+		{
+			throw invalid_argument("Trace capacity must be at least " + to_string(MinimumCapacity) + ".");
+		}
+		limit = 1;
+		while (limit < capacity)
+		{
+			limit <<= 1;
+		}
+		steps.reset(new atomic<uint64_t>[limit * 4]());
+		stepsMask = limit * 2 - 1;
+		copiesSize = max(limit * 2, 64 * BlockCache::MaxLength);
+		copies.reset(new atomic<uint8_t>[copiesSize]());
+	}
+
+	template<class Machine> void Record(const Machine& machine, uint64_t tick, uint16_t address, uint8_t opcode) {	//an interpreted instruction, just run
+		uint8_t bit = opcode == 28 ? (machine.Z >> ((machine.J - 1) & 0xf)) & 1 : 0;	//ldr
+		*cursor++ = (uint8_t)(opcode | bit << 6);
+		if (cursor == stop)
+		{
+			pause(machine, tick, address, opcode);
+		}
+		if (address == Trigger)
+		{
+			trigger(1);
+		}
+	}
+
+	template<class Machine> void Enter(const Machine& machine, uint64_t tick) {	//a block or loop is about to run from stage 1
+		if (stored >= due)
+		{
+			start(machine, tick);
+		}
+		bits = 0;
+		reads = 0;
+	}
+
+	template<class Machine> void Read(const Machine& machine) {	//ldr just ran in the entered block
+		bits |= (uint64_t)((machine.Z >> ((machine.J - 1) & 0xf)) & 1) << reads++;
+	}
+
+	void Replayed(Block& block, uint32_t count) {	//the entered block ran its first count instructions
+		flush();
+		uint64_t code = copy(block);
+		store(Replay | (uint64_t)count << 8 | code << 16, bits);
+		if ((uint32_t)(Trigger - block.start) < 6 * count && (Trigger - block.start) % 6 == 0)
+		{
+			trigger(count);
+		}
+	}
+
+	void Looped(Block& head, Block& tail, uint64_t count, uint16_t read) {	//the entered copy loop ran count instructions, its ldr reading read
+		flush();
+		uint64_t first = copy(head);
+		uint64_t second = copy(tail);
+		store(Loop | (uint64_t)head.opcodes.size() << 8 | (uint64_t)tail.opcodes.size() << 16 | (count & 0xffff) << 24 | (uint64_t)read << 40, first | second << 32);
+		if (((uint32_t)(Trigger - head.start) < 6 * head.opcodes.size() && (Trigger - head.start) % 6 == 0)
+			|| ((uint32_t)(Trigger - tail.start) < 6 * tail.opcodes.size() && (Trigger - tail.start) % 6 == 0))
+		{
+			trigger(count);
+		}
+	}
+
+	void Repeated(uint64_t laps) {	//the block just replayed ran laps more times from the same registers
+		flush();
+		store(Spin, laps);
+	}
+
+	void Taken() {	//an IRQ was just taken
+		if (stored < due)
+		{
+			*cursor++ = Irq;
+			if (cursor == stop)
+			{
+				flush();
+			}
+		}
+	}
+
+	void Flush() {	//publishes the instructions still being packed, before the core returns to the host
+		flush();
+	}
+
+	void Resync() {	//registers may have changed other than by an instruction, the next step stores them
+		due = 0;
+		arm();
+	}
+
+	size_t Capacity() const {	//instructions Records returns at most
+		return limit;
+	}
+
+	vector<TraceRecord> Records() const {	//the last Capacity instructions held, oldest first. may run on another thread while the machine runs
+		return expand(limit);
+	}
+
+	bool Dump(const string& file) const {
+		return write(file, Records());
+	}
+
+	static vector<TraceRecord> Load(const vector<uint8_t>& data) {	//throws invalid_argument or out_of_range on a malformed dump
+		StateReader in(data);
+		if (in.Get(4) != Magic)
+		{
+			throw invalid_argument("Not a trace.");
+		}
+		if (in.Get(2) != Version)
+		{
+			throw invalid_argument("Unsupported trace version.");
+		}
+		uint64_t count = in.Get(4);
+		if (count > in.Remaining() / 16)
+		{
+			throw out_of_range("Trace is truncated.");
+		}
+		vector<TraceRecord> records((size_t)count);
+		for (size_t i = 0; i < records.size(); i++)
+		{
+			records[i].Tick = in.Get(8);
+			records[i].P = (uint16_t)in.Get(2);
+			records[i].Code = (uint8_t)in.Get(1);
+			records[i].Counters = (uint8_t)in.Get(1);
+			records[i].Z = (uint16_t)in.Get(2);
+			records[i].A = (uint16_t)in.Get(2);
+		}
+		return records;
+	}
+
+	static void Decode(const vector<TraceRecord>& records, wostream& out) {	//one line per record: tick, address, mnemonic, register written, bit touched
+		static const wchar_t* const names[] = { L"", L"Z", L"X", L"Y", L"A", L"B", L"D", L"E", L"P", L"V", L"I", L"J", L"C", L"M" };
+		const vector<wstring>& table = mnemonics();
+		for (size_t i = 0; i < records.size(); i++)
+		{
+			const TraceRecord& record = records[i];
+			uint8_t opcode = record.Code & 0x3f;
+			uint8_t written = Written(opcode);
+			out << setw(12) << record.Tick << L"  0x" << hex << setw(4) << setfill(L'0') << record.P << setfill(L' ') << dec << L"  " << table[opcode];
+			if (written != 0 && (opcode < 54 || opcode > 55 || i + 1 < records.size()))
+			{
+				uint16_t value = written >= 10 ? (uint16_t)(written == 10 ? record.Counters & 0xf : written == 11 ? record.Counters >> 4 : written == 12 ? (record.Code >> 6) & 1 : record.Code >> 7)
+					: opcode == 54 || opcode == 55 ? records[i + 1].P : record.Z;	//bzz, bcc: where the next one came from
+				out << L"  " << names[written] << L"=0x" << hex << value << dec;
+			}
+			if ((opcode >> 1) == 14)	//ldr, str
+			{
+				out << (opcode == 28 ? L"  <- 0x" : L"  -> 0x") << hex << setw(4) << setfill(L'0') << record.A << setfill(L' ') << dec;
+			}
+			out << endl;
+		}
+	}
+
+	static uint8_t Written(uint8_t opcode) {	//register opcode writes, index into Decode's names
+		static const uint8_t table[64] = {
+			0, 2, 3, 4, 5, 6, 7, 8,	//nop, mtx..mtp
+			1, 1, 1, 1, 1, 1, 1, 1,	//mfn..mfp
+			1, 1, 1, 1, 1, 1, 1, 1,	//bse..shr
+			1, 1, 1, 1, 1, 0, 11, 1,	//asr, ror, ad1, ad4, ldr, str, mtj, mfj
+			1, 1, 1, 1, 1, 1, 1, 1,	//ld0..ld7
+			1, 1, 1, 1, 1, 1, 1, 1,	//ld8..ldf
+			12, 12, 13, 13, 10, 11, 8, 8,	//clc, sec, clm, sem, cli, clj, bzz, bcc
+			9, 1, 10, 1, 12, 1, 13, 1,	//mtv, mfv, mti, mfi, mtc, mfc, mtm, mfm
+		};
+		return table[opcode & 0x3f];
+	}
+
+private:
+	static const uint8_t Entry = 1;	//u16 P Z X, u64 tick: the registers at stage 1 with Registers, which always follows
+	static const uint8_t Registers = 2;	//u8 I | J << 4, u16 Y A B D E V, u8 C | M << 1
+	static const uint8_t Done = 3;	//u8 opcode, u16 address, u64 tick: the instruction that left the registers stored before it
+	static const uint8_t Step = 4;	//u8 count, then count bytes: opcode | bit ldr read << 6 of an interpreted instruction, or Irq
+	static const uint8_t Replay = 5;	//u8 count, u32 opcodes, u64 one bit per ldr run
+	static const uint8_t Loop = 6;	//u8 head length, u8 tail length, u16 count, u16 bits ldr read, u32 head opcodes, u32 tail opcodes
+	static const uint8_t Spin = 7;	//u64 laps of the last Replay
+	static const uint8_t Irq = 0x80;	//in a Step, an IRQ taken: P and V swapped through T
+	static const uint64_t Pending = 3;	//steps stored before their count is published, at most
+	static const uint32_t Spare = 2 * BlockCache::MaxLength;	//opcodes copied before the step using them is published, at most
+
+	uint8_t* cursor = packed + 2;	//where the next interpreted instruction is packed, first with Trigger in one cache line
+	uint8_t* stop = packed + 3;	//cursor at which Record leaves the inlined path: the Step is full, or the registers are due
+	unique_ptr<atomic<uint64_t>[]> steps;	//two words each: the kind in the low byte of the first, the rest packed as listed above
+	uint64_t stepsMask = 0;
+	uint64_t stored = 0;	//steps ever stored, the next goes to steps[(stored & stepsMask) * 2]. the producer's own copy of published
+	atomic<uint64_t> published{ 0 };
+	unique_ptr<atomic<uint8_t>[]> copies;	//opcodes of the blocks run
+	size_t copiesSize = 0;
+	uint64_t copied = 0;	//likewise, of opcodes
+	atomic<uint64_t> copiedCount{ 0 };
+	size_t limit = 0;
+	uint64_t due = 0;	//stored at which the registers are stored again, so the ring always holds a start. 0 while the steps do not follow them
+	uint64_t copiedDue = 0;	//copied likewise, so the opcodes the last start is followed by are still held
+	uint8_t packed[16] = { Step };	//the Step being filled, stored when full or another step follows. its count is set when stored
+	uint64_t bits = 0;	//ldr reads of the entered block
+	uint32_t reads = 0;
+	vector<TraceRecord>(TraceBuffer::* expander)(const vector<uint64_t>&, const vector<uint8_t>&, uint64_t, size_t) const = nullptr;	//rerun for the machine type that recorded, set before the first step is published
+
+	void put(uint64_t offset, uint64_t first, uint64_t second) {	//the step offset past the last one stored
+		atomic<uint64_t>* at = &steps[(size_t)((stored + offset) & stepsMask) * 2];
+		at[0].store(first, memory_order_relaxed);
+		at[1].store(second, memory_order_relaxed);
+	}
+
+	void publish(uint64_t count) {	//count steps were put
+		stored += count;
+		published.store(stored, memory_order_release);
+		atomic_thread_fence(memory_order_release);	//a reader seeing what is stored next over older steps sees this count too
+		arm();
+	}
+
+	void arm() {	//after stored or due changed
+		stop = stored < due ? packed + 16 : cursor + 1;
+	}
+
+	void store(uint64_t first, uint64_t second) {
+		put(0, first, second);
+		publish(1);
+	}
+
+	void flush() {
+		if (cursor != packed + 2)
+		{
+			packed[1] = (uint8_t)(cursor - packed - 2);
+			cursor = packed + 2;
+			uint64_t words[2];
+			memcpy(words, packed, sizeof(words));
+			store(words[0], words[1]);
+		}
+	}
+
+	template<class Machine>
+#if defined(__GNUC__)
+	__attribute__((noinline, cold))
+#endif
+	void pause(const Machine& machine, uint64_t tick, uint16_t address, uint8_t opcode) {	//Record reached stop
+		if (stored < due)
+		{
+			flush();
+		}
+		else
+		{
+			cursor--;	//stored with the registers it left instead
+			single(machine, tick, address, opcode);
+		}
+	}
+
+#if defined(__GNUC__)
+	__attribute__((noinline))
+#endif
+	void place(Block& block) {	//copies the block's opcodes. this and the rest storing registers are kept out of the inlined recording path
+		for (size_t i = 0; i < block.opcodes.size(); i++)
+		{
+			copies[(size_t)((copied + i) & (copiesSize - 1))].store(block.opcodes[i], memory_order_relaxed);
+		}
+		block.tracer = this;
+		block.traced = (uint32_t)copied;
+		copied += block.opcodes.size();
+		copiedCount.store(copied, memory_order_relaxed);	//published with the step
+		if (copied >= copiedDue)
+		{
+			due = 0;
+		}
+	}
+
+	template<class Machine>
+#if defined(__GNUC__)
+	__attribute__((noinline))
+#endif
+	void single(const Machine& machine, uint64_t tick, uint16_t address, uint8_t opcode) {	//the interpreted instruction with the registers it left
+		begin<Machine>(machine, tick + Machine::ticks(opcode));
+		put(2, Done | (uint64_t)opcode << 8 | (uint64_t)address << 16, tick);
+		publish(3);
+	}
+
+	template<class Machine>
+#if defined(__GNUC__)
+	__attribute__((noinline))
+#endif
+	void start(const Machine& machine, uint64_t tick) {
+		begin<Machine>(machine, tick);
+		publish(2);
+	}
+
+	template<class Machine> void begin(const Machine& machine, uint64_t tick) {	//puts the registers as the next two steps, which later ones follow
+		flush();
+		if (expander != &TraceBuffer::rerun<Machine>)
+		{
+			expander = &TraceBuffer::rerun<Machine>;
+		}
+		put(0, Entry | (uint64_t)machine.P << 16 | (uint64_t)machine.Z << 32 | (uint64_t)machine.X << 48, tick);
+		put(1, Registers | (uint64_t)(machine.I | machine.J << 4) << 8 | (uint64_t)machine.Y << 16 | (uint64_t)machine.A << 32 | (uint64_t)machine.B << 48,
+			machine.D | (uint64_t)machine.E << 16 | (uint64_t)machine.V << 32 | (uint64_t)(machine.C | machine.M << 1) << 48);
+		due = stored + (stepsMask + 1) / 4;
+		copiedDue = copied + copiesSize / 4;
+	}
+
+	uint32_t copy(Block& block) {	//where the block's opcodes are, copied unless they are already and stay for half the ring
+		if (block.tracer != this || (uint32_t)copied - block.traced > copiesSize / 2)
+		{
+			place(block);
+		}
+		return block.traced;
+	}
+
+	vector<TraceRecord> expand(size_t most) const {	//the last most instructions held
+		uint64_t end = published.load(memory_order_acquire);
+		if (end == 0)
+		{
+			return vector<TraceRecord>();
+		}
+		uint64_t first = end > stepsMask + 1 ? end - stepsMask - 1 : 0;
+		vector<uint64_t> words((size_t)(end - first) * 2);
+		for (size_t i = 0; i < words.size(); i++)
+		{
+			words[i] = steps[(size_t)((first + i / 2) & stepsMask) * 2 + i % 2].load(memory_order_relaxed);
+		}
+		vector<uint8_t> code(copiesSize);
+		for (size_t i = 0; i < code.size(); i++)
+		{
+			code[i] = copies[i].load(memory_order_relaxed);
+		}
+		atomic_thread_fence(memory_order_acquire);	//what was stored over the copies meanwhile shows in the counts
+		uint64_t valid = published.load(memory_order_relaxed) + Pending;
+		uint64_t made = copiedCount.load(memory_order_relaxed);
+		if (valid > first + stepsMask + 1)
+		{
+			words.erase(words.begin(), words.begin() + (size_t)min(valid - first - stepsMask - 1, end - first) * 2);
+		}
+		return (this->*expander)(words, code, made, most);
+	}
+
+	template<class Machine> vector<TraceRecord> rerun(const vector<uint64_t>& words, const vector<uint8_t>& code, uint64_t made, size_t most) const {	//words: the steps held oldest first, code: the opcode ring, made: opcodes copied by then
+		size_t count = words.size() / 2;
+		size_t at = 0;
+		while (at < count && (words[at * 2] & 0xff) != Entry)
+		{
+			at++;
+		}
+		vector<TraceRecord> records;
+		unique_ptr<Machine> machine(new Machine());
+		uint64_t tick = 0;
+		size_t last = count;	//the last Replay, for Spin
+		while (at < count)
+		{
+			uint64_t first = words[at * 2];
+			uint64_t second = words[at * 2 + 1];
+			uint8_t kind = (uint8_t)first;
+			if (kind == Entry && at + 1 < count)
+			{
+				uint64_t more = words[at * 2 + 2];
+				uint64_t rest = words[at * 2 + 3];
+				machine->P = (uint16_t)(first >> 16);
+				machine->Z = (uint16_t)(first >> 32);
+				machine->X = (uint16_t)(first >> 48);
+				machine->I = (more >> 8) & 0xf;
+				machine->J = (more >> 12) & 0xf;
+				machine->Y = (uint16_t)(more >> 16);
+				machine->A = (uint16_t)(more >> 32);
+				machine->B = (uint16_t)(more >> 48);
+				machine->D = (uint16_t)rest;
+				machine->E = (uint16_t)(rest >> 16);
+				machine->V = (uint16_t)(rest >> 32);
+				machine->C = ((rest >> 48) & 1) != 0;
+				machine->M = ((rest >> 49) & 1) != 0;
+				tick = second;
+				at += 2;
+				continue;
+			}
+			if (kind == Done)
+			{
+				uint8_t opcode = (uint8_t)(first >> 8);
+				TraceRecord record;
+				record.Tick = second;
+				record.P = (uint16_t)(first >> 16);
+				record.Code = (uint8_t)(opcode | machine->C << 6 | machine->M << 7);
+				record.Counters = (uint8_t)(machine->I | machine->J << 4);
+				record.Z = machine->Z;
+				record.A = machine->A;
+				records.push_back(record);
+			}
+			else if (kind == Step)
+			{
+				uint8_t bytes[16];
+				memcpy(bytes, &words[at * 2], sizeof(bytes));
+				for (uint8_t i = 0; i < bytes[1]; i++)
+				{
+					if (bytes[2 + i] == Irq)
+					{
+						machine->T = machine->P;
+						machine->P = machine->V;
+						machine->V = machine->T;
+					}
+					else
+					{
+						run(*machine, bytes[2 + i] & 0x3f, bytes[2 + i] >> 6, tick, records);
+					}
+				}
+			}
+			else if ((kind == Replay && !held((uint32_t)(first >> 16), made)) || (kind == Loop && (!held((uint32_t)second, made) || !held((uint32_t)(second >> 32), made))))	//opcodes gone, so is everything up to the next registers
+			{
+				records.clear();
+				while (at + 1 < count && (words[at * 2 + 2] & 0xff) != Entry)
+				{
+					at++;
+				}
+			}
+			else if (kind == Replay)
+			{
+				last = at;
+				replay(*machine, first, second, code, tick, records);
+			}
+			else if (kind == Loop)
+			{
+				uint32_t split = (first >> 8) & 0xff;
+				uint32_t length = split + ((first >> 16) & 0xff);
+				uint32_t instructions = (first >> 24) & 0xffff;
+				uint16_t read = (uint16_t)(first >> 40);
+				for (uint32_t i = 0, n = 0; i < instructions; i++)
+				{
+					uint32_t j = i % length;
+					uint8_t opcode = code[(size_t)(j < split ? (uint32_t)second + j : (uint32_t)(second >> 32) + j - split) % code.size()];
+					run(*machine, opcode, opcode == 28 ? (read >> n++) & 1 : 0, tick, records);
+				}
+			}
+			else if (kind == Spin && last < count)
+			{
+				uint64_t replayed = words[last * 2];
+				uint32_t length = (replayed >> 8) & 0xff;
+				uint64_t kept = min(second, (uint64_t)(most / length + 1));	//the rest would be dropped below
+				uint64_t lap = 0;
+				for (uint32_t i = 0; i < length; i++)
+				{
+					lap += Machine::ticks(code[(size_t)((uint32_t)(replayed >> 16) + i) % code.size()]);
+				}
+				tick += (second - kept) * lap;
+				for (uint64_t i = 0; i < kept; i++)
+				{
+					replay(*machine, replayed, words[last * 2 + 1], code, tick, records);
+				}
+			}
+			at++;
+			if (records.size() >= 2 * most)
+			{
+				records.erase(records.begin(), records.end() - most);
+			}
+		}
+		if (records.size() > most)
+		{
+			records.erase(records.begin(), records.end() - most);
+		}
+		return records;
+	}
+
+	bool held(uint32_t at, uint64_t made) const {	//opcodes copied to at were not overwritten by the time made were copied
+		return (uint32_t)made - at <= copiesSize - Spare;
+	}
+
+	template<class Machine> static void replay(Machine& machine, uint64_t first, uint64_t read, const vector<uint8_t>& code, uint64_t& tick, vector<TraceRecord>& records) {	//reruns a Replay step
+		uint32_t at = (uint32_t)(first >> 16);
+		uint32_t count = (first >> 8) & 0xff;
+		uint32_t n = 0;
+		for (uint32_t i = 0; i < count; i++)
+		{
+			uint8_t opcode = code[(size_t)(at + i) % code.size()];
+			run(machine, opcode, opcode == 28 ? (read >> n++) & 1 : 0, tick, records);
+		}
+	}
+
+	template<class Machine> static void run(Machine& machine, uint8_t opcode, uint64_t bit, uint64_t& tick, vector<TraceRecord>& records) {	//the instruction at P, bit is what an ldr read
+		TraceRecord record;
+		record.Tick = tick;
+		record.P = machine.P;
+		machine.P = (uint16_t)(machine.P + 6);
+		machine.inst = opcode;
+		if (opcode == 28)	//ldr
+		{
+			machine.Z = (uint16_t)((machine.Z & ~(1 << machine.J)) | bit << machine.J);
+			machine.J = (machine.J + 1) & 0xf;
+		}
+		else if (opcode == 29)	//str, memory is not kept
+		{
+			machine.J = (machine.J + 1) & 0xf;
+		}
+		else
+		{
+			machine.dispatch(opcode);
+		}
+		record.Code = (uint8_t)(opcode | machine.C << 6 | machine.M << 7);
+		record.Counters = (uint8_t)(machine.I | machine.J << 4);
+		record.Z = machine.Z;
+		record.A = machine.A;
+		records.push_back(record);
+		tick += Machine::ticks(opcode);
+	}
+
+	static bool write(const string& file, const vector<TraceRecord>& records) {
+		StateWriter out;
+		out.Put(Magic, 4);
+		out.Put(Version, 2);
+		out.Put(records.size(), 4);
+		for (size_t i = 0; i < records.size(); i++)
+		{
+			out.Put(records[i].Tick, 8);
+			out.Put(records[i].P, 2);
+			out.Put(records[i].Code, 1);
+			out.Put(records[i].Counters, 1);
+			out.Put(records[i].Z, 2);
+			out.Put(records[i].A, 2);
+		}
+		ofstream ofs(file, ios_base::binary | ios_base::out);
+		ofs.write((const char*)out.Data.data(), out.Data.size());
+		return !ofs.fail();
+	}
+
+#if defined(__GNUC__)
+	__attribute__((noinline))
+#endif
+	void trigger(uint64_t count) {	//the last step, count instructions, ran Trigger. kept out of the inlined recording path
+		if (Triggered)
+		{
+			return;
+		}
+		flush();
+		vector<TraceRecord> records = expand(limit + (size_t)count);	//Capacity before the last step
+		size_t at = records.size() - (size_t)min(count, (uint64_t)records.size());
+		while (at < records.size() && records[at].P != Trigger)
+		{
+			at++;
+		}
+		if (at == records.size())	//rebuilt from older steps only
+		{
+			return;
+		}
+		records.resize(at + 1);	//stop at the first execution, as the interpreter would
+		records.erase(records.begin(), records.end() - min(records.size(), limit));
+		Triggered = true;
+		TriggerTick = records.back().Tick;
+		write(File, records);
+	}
+
+	static const vector<wstring>& mnemonics() {	//opcode to mnemonic, from the assembler's table
+		static const vector<wstring> table = []() {
+			vector<wstring> table(64);
+			instructions insts;
+			for (map<wstring, instruction>::const_iterator i = insts.inst.begin(); i != insts.inst.end(); i++)
+			{
+				size_t opcode = (size_t)i->second.opcode.to_ulong();
+				if (i->second.itype == instructionType::mnemonic && (table[opcode].empty() || i->first == L"nop"))	//nop over its alias mtn
+				{
+					table[opcode] = i->first;
+				}
+			}
+			return table;
+		}();
+		return table;
+	}
+};
@@ -0,0 +1,298 @@
+#pragma once
+#include<stdint.h>
+#include<string>
+#include<vector>
+#include<sstream>
+#include<random>
+#include<thread>
+#include<atomic>
+#include<mutex>
+#include<functional>
+#include<memory>
+#include<algorithm>
+
+#include"memory.h"
+#include"savestate.h"
+#include"blockcache.h"
+#include"lockstep.h"
+
+using namespace std;
+
+class Divergence {	//first disagreement between reference and candidate
+public:
+	uint64_t Seed = 0;	//of the random program, when it came from Verifier::Randomize
+	int32_t Lane = -1;	//of the Lockstep the candidate ran in, -1 for none
+	uint64_t Tick = 0;	//first tick the machines are seen to disagree at, the end of the shortest run from the last matching state that does
+	uint16_t P = 0;	//reference P at Tick
+	uint8_t Opcode = 0;	//reference instruction in flight or last completed at Tick
+	vector<string> Registers;	//"name reference candidate"
+	vector<pair<uint16_t, pair<uint64_t, uint64_t>>> Words;	//Memory::Bits index, reference, candidate
+
+	string Describe() const {
+		ostringstream out;
+		out << "seed " << Seed << (Lane >= 0 ? " lane " + to_string(Lane) : "") << " tick " << Tick << " P 0x" << hex << P << dec << " opcode " << (unsigned)Opcode;
+		for (size_t i = 0; i < Registers.size(); i++)
+		{
+			out << "\n\t" << Registers[i];
+		}
+		for (size_t i = 0; i < Words.size(); i++)
+		{
+			out << "\n\tbits 0x" << hex << Words[i].first * 64 << ": 0x" << Words[i].second.first << " 0x" << Words[i].second.second << dec;
+		}
+		return out.str();
+	}
+};
+
+/*
+differential verifier: runs a candidate engine next to the reference, the interpreter taken stage by stage,
+and compares registers, Tick, Instructions, queued IRQ levels and inputs and every memory word after each Interval ticks.
+on a mismatch both sides restart from the last matching state and the shortest run that disagrees is found by bisection,
+so a large Interval costs nothing in precision. a fast path only taken for long enough budgets shows up at the end of the
+first block or run it replays, which is as fine as the candidate can be observed. Interval 8 compares after about every instruction.
+Randomize builds a random ROM, RAM, register file and IRQ schedule from a seed, Soak checks a range of seeds on several threads.
+with Lockstepped, Soak instead runs Lanes machines of each seed together in a Lockstep, one ROM with registers that differ,
+and checks every lane against a twin running on its own Execute with Candidate, the plain Lane8 loops included where there is no AVX2.
+callbacks are not part of a save state, so a machine to verify must not depend on them.
+*/
+template<class Machine> class Verifier {
+public:
+	static const size_t Lanes = 32;	//machines per Lockstep
+	Engine Candidate = Engine::Blocks;
+	uint64_t Interval = 100000;	//ticks between comparisons
+	bool Lockstepped = false;
+
+	bool Verify(Machine& reference, Machine& candidate, uint64_t ticks, Divergence& divergence) const {	//machines must start equal, false on the first divergence
+		reference.engine = Engine::Interpreter;
+		reference.StageStepping = true;
+		candidate.engine = Candidate;
+		uint64_t end = reference.Tick + ticks;
+		while (reference.Tick < end)
+		{
+			vector<uint8_t> good = reference.SaveState();
+			uint64_t slice = min(max(Interval, (uint64_t)1), end - reference.Tick);
+			reference.Execute((size_t)slice);
+			candidate.Execute((size_t)slice);
+			if (!same(reference, candidate))
+			{
+				locate(reference, candidate, good, slice, divergence);
+				return false;
+			}
+		}
+		return true;
+	}
+
+	bool VerifyLockstep(vector<Machine>& references, vector<Machine>& candidates, uint64_t ticks, Divergence& divergence) const {	//Lanes machines each, starting equal in pairs, false on the first lane to diverge. no bisection, Tick is the end of the Interval it was seen in
+		Lockstep<Machine, Lanes> lockstep;
+		lockstep.Vectorized = true;
+		for (size_t l = 0; l < Lanes; l++)
+		{
+			references[l].engine = Candidate;
+			candidates[l].engine = Candidate;
+			lockstep.Machines[l] = &candidates[l];
+		}
+		for (uint64_t done = 0; done < ticks;)
+		{
+			uint64_t slice = min(max(Interval, (uint64_t)1), ticks - done);
+			lockstep.Execute((size_t)slice);
+			for (size_t l = 0; l < Lanes; l++)
+			{
+				references[l].Execute((size_t)slice);
+			}
+			done += slice;
+			for (size_t l = 0; l < Lanes; l++)
+			{
+				if (!same(references[l], candidates[l]))
+				{
+					describe(references[l], candidates[l], divergence);
+					divergence.Lane = (int32_t)l;
+					return false;
+				}
+			}
+		}
+		return true;
+	}
+
+	static shared_ptr<const Rom> Randomize(Machine& machine, uint64_t seed, uint64_t ticks) {	//loads a random program and state into a new machine, returns its ROM
+		mt19937_64 random(seed);
+		vector<bool> input(0x8000 - (size_t)(random() % 0x2000));
+		for (size_t i = 0; i + 6 <= input.size(); i += 6)
+		{
+			uint8_t opcode = (uint8_t)(random() & 0x3f);
+			while ((opcode == 7 || opcode == 54 || opcode == 55) && random() % 4 != 0)	//mtp, bzz, bcc: fewer jumps, longer blocks
+			{
+				opcode = (uint8_t)(random() & 0x3f);
+			}
+			for (size_t j = 0; j < 6; j++)
+			{
+				input[i + j] = (opcode >> j) & 1;
+			}
+		}
+		shared_ptr<const Rom> rom = make_shared<const Rom>(input);
+		machine.memory.Load(rom);
+		scramble(machine, random, ticks);
+		return rom;
+	}
+
+	static shared_ptr<const Rom> RandomizeLanes(vector<Machine>& machines, uint64_t seed, uint64_t ticks) {	//Randomize into the first machine, then the rest on the same ROM with their own RAM, registers and IRQs, most at the same P
+		shared_ptr<const Rom> rom = Randomize(machines[0], seed, ticks);
+		mt19937_64 random(seed ^ 0x9e3779b97f4a7c15ull);
+		for (size_t l = 1; l < machines.size(); l++)
+		{
+			machines[l].memory.Load(rom);
+			scramble(machines[l], random, ticks);
+			if (l % 4 != 0)	//lanes at one P form a group
+			{
+				machines[l].P = machines[0].P;
+			}
+		}
+		return rom;
+	}
+
+	bool Soak(uint64_t first, uint64_t count, uint64_t ticks, unsigned threads, Divergence& divergence, uint64_t& verified) const {	//seeds first..first+count-1, false on the first divergence found
+		atomic<uint64_t> next(first), done(0);
+		atomic<bool> failed(false);
+		mutex lock;
+		vector<thread> workers;
+		for (unsigned i = 0; i < max(threads, 1u); i++)
+		{
+			workers.push_back(thread([&]() {
+				uint64_t seed;
+				while (!failed && (seed = next++) < first + count)
+				{
+					Divergence found;
+					if (check(seed, ticks, found))
+					{
+						done++;
+					}
+					else
+					{
+						lock_guard<mutex> guard(lock);
+						if (!failed || seed < divergence.Seed)
+						{
+							found.Seed = seed;
+							divergence = found;
+							failed = true;
+						}
+					}
+				}
+			}));
+		}
+		for (size_t i = 0; i < workers.size(); i++)
+		{
+			workers[i].join();
+		}
+		verified = done;
+		return !failed;
+	}
+
+private:
+	static void scramble(Machine& machine, mt19937_64& random, uint64_t ticks) {	//random RAM, registers and IRQ schedule
+		for (uint32_t address = 0x8000; address < 0xf010; address += 16)
+		{
+			machine.memory.write((uint16_t)address, (uint16_t)random());
+		}
+		uint16_t* words[] = { &machine.Z, &machine.X, &machine.Y, &machine.A, &machine.B, &machine.D, &machine.E, &machine.V, &machine.T };
+		for (size_t i = 0; i < 9; i++)
+		{
+			*words[i] = (uint16_t)random();
+		}
+		machine.P = (uint16_t)(random() % 0x100 * 6);
+		machine.I = (uint8_t)(random() & 0xf);
+		machine.J = (uint8_t)(random() & 0xf);
+		machine.C = (random() & 1) != 0;
+		machine.M = (random() & 1) != 0;
+		uint64_t tick = 0;
+		while (ticks != 0 && (tick += random() % (ticks / 8 + 1)) < ticks)
+		{
+			machine.PostIRQ(tick, (random() & 1) != 0);
+		}
+	}
+
+	bool check(uint64_t seed, uint64_t ticks, Divergence& divergence) const {	//one seed of Soak
+		if (Lockstepped)
+		{
+			vector<Machine> references(Lanes), candidates(Lanes);
+			shared_ptr<const Rom> rom = RandomizeLanes(references, seed, ticks);
+			for (size_t l = 0; l < Lanes; l++)
+			{
+				candidates[l].LoadState(references[l].SaveState(), rom);
+			}
+			return VerifyLockstep(references, candidates, ticks, divergence);
+		}
+		Machine reference, candidate;
+		shared_ptr<const Rom> rom = Randomize(reference, seed, ticks);
+		candidate.LoadState(reference.SaveState(), rom);
+		return Verify(reference, candidate, ticks, divergence);
+	}
+
+	static vector<string> compare(const Machine& reference, const Machine& candidate) {
+		vector<string> registers;
+		const uint16_t r16[] = { reference.Z, reference.X, reference.Y, reference.A, reference.B, reference.D, reference.E, reference.P, reference.V, reference.T };
+		const uint16_t c16[] = { candidate.Z, candidate.X, candidate.Y, candidate.A, candidate.B, candidate.D, candidate.E, candidate.P, candidate.V, candidate.T };
+		const char* n16[] = { "Z", "X", "Y", "A", "B", "D", "E", "P", "V", "T" };
+		for (size_t i = 0; i < 10; i++)
+		{
+			if (r16[i] != c16[i])
+			{
+				registers.push_back(string(n16[i]) + " " + to_string(r16[i]) + " " + to_string(c16[i]));
+			}
+		}
+		const uint64_t r64[] = { reference.I, reference.J, reference.inst, reference.stage, reference.C, reference.M, reference.IRQ, reference.Tick, reference.Instructions };
+		const uint64_t c64[] = { candidate.I, candidate.J, candidate.inst, candidate.stage, candidate.C, candidate.M, candidate.IRQ, candidate.Tick, candidate.Instructions };
+		const char* n64[] = { "I", "J", "inst", "stage", "C", "M", "IRQ", "Tick", "Instructions" };
+		for (size_t i = 0; i < 9; i++)
+		{
+			if (r64[i] != c64[i])
+			{
+				registers.push_back(string(n64[i]) + " " + to_string(r64[i]) + " " + to_string(c64[i]));
+			}
+		}
+		if (reference.Core().Levels != candidate.Core().Levels)
+		{
+			registers.push_back("Levels " + to_string(reference.Core().Levels.size()) + " " + to_string(candidate.Core().Levels.size()));
+		}
+		if (reference.Core().Inputs != candidate.Core().Inputs)
+		{
+			registers.push_back("Inputs " + to_string(reference.Core().Inputs.size()) + " " + to_string(candidate.Core().Inputs.size()));
+		}
+		return registers;
+	}
+
+	static bool same(const Machine& reference, const Machine& candidate) {
+		return compare(reference, candidate).empty() && equal(reference.memory.Bits, reference.memory.Bits + 0x400, candidate.memory.Bits);
+	}
+
+	void restart(Machine& reference, Machine& candidate, const vector<uint8_t>& good, uint64_t ticks) const {	//both from good, then ticks ticks
+		reference.LoadState(good);
+		candidate.LoadState(good);
+		reference.Execute((size_t)ticks);
+		candidate.Execute((size_t)ticks);
+	}
+
+	void locate(Machine& reference, Machine& candidate, const vector<uint8_t>& good, uint64_t slice, Divergence& divergence) const {	//smallest diverging slice from good
+		uint64_t low = 0, high = slice;	//low agrees, high does not
+		while (high - low > 1)
+		{
+			uint64_t middle = low + (high - low) / 2;
+			restart(reference, candidate, good, middle);
+			(same(reference, candidate) ? low : high) = middle;
+		}
+		restart(reference, candidate, good, high);
+		describe(reference, candidate, divergence);
+	}
+
+	static void describe(const Machine& reference, const Machine& candidate, Divergence& divergence) {	//how the two differ now
+		divergence.Tick = reference.Tick;
+		divergence.P = reference.P;
+		divergence.Opcode = reference.inst;
+		divergence.Registers = compare(reference, candidate);
+		divergence.Words.clear();
+		for (size_t i = 0; i < 0x400; i++)
+		{
+			if (reference.memory.Bits[i] != candidate.memory.Bits[i])
+			{
+				divergence.Words.push_back(make_pair((uint16_t)i, make_pair(reference.memory.Bits[i], candidate.memory.Bits[i])));
+			}
+		}
+	}
+};